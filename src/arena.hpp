@@ -0,0 +1,200 @@
+#ifndef KNIGHT_ARENA_HPP_INCLUDED
+#define KNIGHT_ARENA_HPP_INCLUDED
+
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "eval.hpp"
+
+namespace kn::parser {
+
+  // a single instruction, linked to the one after it; the instruction
+  // itself follows the node in the arena, flattened into code points,
+  // so it only takes up as many labels as its opcode has
+  struct Node {
+    Node* next;
+
+    eval::CodePoint* code() noexcept {
+      return reinterpret_cast<eval::CodePoint*>(this + 1);
+    }
+    const eval::CodePoint* code() const noexcept {
+      return reinterpret_cast<const eval::CodePoint*>(this + 1);
+    }
+    // how many code points the instruction is
+    std::size_t size() const noexcept { return 1 + eval::num_labels(op()); }
+
+    eval::OpCode op() const noexcept { return code()->op; }
+    eval::Label& label(std::size_t i) noexcept { return code()[i + 1].label; }
+    const eval::Label& label(std::size_t i) const noexcept { return code()[i + 1].label; }
+  };
+  static_assert(std::is_trivially_destructible_v<Node>);
+  static_assert(std::is_trivially_destructible_v<eval::CodePoint>);
+  static_assert(sizeof(Node) % alignof(eval::CodePoint) == 0
+                and alignof(Node) >= alignof(eval::CodePoint));
+
+  // where all the instructions of a parse live; they're allocated a chunk
+  // at a time, and only ever freed all together with the arena
+  class Arena {
+  public:
+    Arena() = default;
+    Arena(Arena&& other) noexcept
+      : chunks(std::move(other.chunks))
+      , used(std::exchange(other.used, chunk_size))
+    {}
+    Arena& operator=(Arena&& other) noexcept {
+      chunks = std::move(other.chunks);
+      used = std::exchange(other.used, chunk_size);
+      return *this;
+    }
+
+    // any labels not given are left blank
+    template <typename... Args>
+    Node* make(eval::OpCode op, Args... labels) {
+      auto num_labels = eval::num_labels(op);
+      assert(sizeof...(labels) <= num_labels);
+      auto bytes = sizeof(Node) + (1 + num_labels) * sizeof(eval::CodePoint);
+      auto size = (bytes + sizeof(Word) - 1) / sizeof(Word);
+      if (chunk_size - used < size) {
+        chunks.push_back(std::make_unique<Word[]>(chunk_size));
+        used = 0;
+      }
+
+      auto node = new (&chunks.back()[used]) Node{ nullptr };
+      used += size;
+      auto code = node->code();
+      new (code++) eval::CodePoint(op);
+      (new (code++) eval::CodePoint(eval::Label(labels)), ...);
+      for (auto last = node->code() + 1 + num_labels; code != last; ++code)
+        new (code) eval::CodePoint(eval::Label{});
+      return node;
+    }
+
+    // take over everything in `other`, so that it can outlive it
+    void adopt(Arena&& other) {
+      // keep our partly used chunk at the back
+      chunks.insert(chunks.begin(),
+        std::make_move_iterator(other.chunks.begin()),
+        std::make_move_iterator(other.chunks.end()));
+      other.chunks.clear();
+      other.used = chunk_size;
+    }
+
+  private:
+    // nodes are carved out of chunks of these
+    using Word = std::aligned_storage_t<sizeof(Node), alignof(Node)>;
+    static constexpr std::size_t chunk_size = 8 * 1024;
+
+    std::vector<std::unique_ptr<Word[]>> chunks;
+    std::size_t used = chunk_size;
+  };
+
+  // a list of instructions from an arena; joining two lists just links
+  // them together, so building up a program never copies instructions
+  class Block {
+  public:
+    template <bool Const>
+    class basic_iterator {
+    public:
+      using value_type = Node;
+      using reference = std::conditional_t<Const, const Node&, Node&>;
+      using pointer = std::conditional_t<Const, const Node*, Node*>;
+      using difference_type = std::ptrdiff_t;
+      using iterator_category = std::forward_iterator_tag;
+
+      basic_iterator() = default;
+      explicit basic_iterator(Node* node) noexcept : node(node) {}
+
+      reference operator*() const noexcept { return *node; }
+      pointer operator->() const noexcept { return node; }
+
+      basic_iterator& operator++() noexcept {
+        node = node->next;
+        return *this;
+      }
+      basic_iterator operator++(int) noexcept {
+        auto old = *this;
+        ++*this;
+        return old;
+      }
+
+      friend bool operator==(basic_iterator lhs, basic_iterator rhs) noexcept {
+        return lhs.node == rhs.node;
+      }
+      friend bool operator!=(basic_iterator lhs, basic_iterator rhs) noexcept {
+        return lhs.node != rhs.node;
+      }
+
+    private:
+      friend class Block;
+      Node* node = nullptr;
+    };
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    Block() = default;
+    Block(Node* node) noexcept : head(node), tail(node) {}
+
+    // lists own their nodes, so can only be moved
+    Block(Block&& other) noexcept
+      : head(std::exchange(other.head, nullptr))
+      , tail(std::exchange(other.tail, nullptr))
+    {}
+    Block& operator=(Block&& other) noexcept {
+      head = std::exchange(other.head, nullptr);
+      tail = std::exchange(other.tail, nullptr);
+      return *this;
+    }
+
+    bool empty() const noexcept { return head == nullptr; }
+
+    Node& front() noexcept { return *head; }
+    const Node& front() const noexcept { return *head; }
+
+    iterator begin() noexcept { return iterator(head); }
+    iterator end() noexcept { return iterator(); }
+    const_iterator begin() const noexcept { return const_iterator(head); }
+    const_iterator end() const noexcept { return const_iterator(); }
+
+    void push_back(Node* node) noexcept {
+      (empty() ? head : tail->next) = node;
+      tail = node;
+    }
+
+    void push_front(Node* node) noexcept {
+      node->next = head;
+      head = node;
+      if (not tail)
+        tail = node;
+    }
+
+    // put `node` just after `pos`, which has to be in this list
+    void insert_after(iterator pos, Node* node) noexcept {
+      node->next = pos.node->next;
+      pos.node->next = node;
+      if (tail == pos.node)
+        tail = node;
+    }
+
+    // move everything in `other` onto the end of this
+    void splice(Block&& other) noexcept {
+      if (other.empty())
+        return;
+      (empty() ? head : tail->next) = other.head;
+      tail = other.tail;
+      other.head = other.tail = nullptr;
+    }
+
+  private:
+    Node* head = nullptr;
+    Node* tail = nullptr;
+  };
+
+}
+
+#endif  // KNIGHT_ARENA_HPP_INCLUDED
@@ -0,0 +1,391 @@
+#include "batch.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "env.hpp"
+#include "error.hpp"
+#include "eval.hpp"
+#include "ir.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "scheduler.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+  struct Job {
+    fs::path script;
+    fs::path input;  // empty if the script gets no input
+  };
+
+  struct Result {
+    int status = 0;
+    double latency = 0;  // milliseconds
+  };
+
+  // a worker's own queue; it takes from the back, thieves take from the front
+  class WorkQueue {
+  public:
+    void push(std::size_t job) {
+      auto lock = std::lock_guard(mutex);
+      jobs.push_back(job);
+    }
+
+    std::optional<std::size_t> pop() {
+      auto lock = std::lock_guard(mutex);
+      if (jobs.empty())
+        return std::nullopt;
+      auto job = jobs.back();
+      jobs.pop_back();
+      return job;
+    }
+
+    std::optional<std::size_t> steal() {
+      auto lock = std::lock_guard(mutex);
+      if (jobs.empty())
+        return std::nullopt;
+      auto job = jobs.front();
+      jobs.pop_front();
+      return job;
+    }
+
+  private:
+    std::mutex mutex;
+    std::deque<std::size_t> jobs;
+  };
+
+  std::vector<Job> collect_jobs(const fs::path& source) {
+    auto jobs = std::vector<Job>{};
+
+    if (fs::is_directory(source)) {
+      for (const auto& entry : fs::directory_iterator(source)) {
+        if (entry.path().extension() != ".kn")
+          continue;
+        auto input = fs::path(entry.path()).replace_extension(".in");
+        if (not fs::exists(input))
+          input.clear();
+        jobs.push_back({ entry.path(), std::move(input) });
+      }
+      std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) {
+        return a.script < b.script;
+      });
+      return jobs;
+    }
+
+    auto manifest = std::ifstream(source);
+    if (not manifest)
+      throw kn::Error("error: unable to read batch manifest " + source.string());
+
+    auto base = source.parent_path();
+    auto line = std::string{};
+    while (std::getline(manifest, line)) {
+      auto iss = std::istringstream(line);
+      auto script = std::string{};
+      auto input = std::string{};
+      if (not (iss >> script) or script[0] == '#')
+        continue;
+      iss >> input;
+      jobs.push_back({ base / script, input.empty() ? fs::path() : base / input });
+    }
+
+    // results are named after the script, which has to tell them apart
+    auto names = std::unordered_set<std::string>{};
+    for (const auto& job : jobs) {
+      if (auto name = job.script.stem().string(); not names.insert(name).second)
+        throw kn::Error("error: batch manifest has more than one script named " + name);
+    }
+    return jobs;
+  }
+
+  // a script's output, which only has its file open while a full buffer
+  // is being appended to it, so that thousands of scripts sitting idle
+  // don't need a file descriptor each
+  class OutputFile : public std::streambuf {
+  public:
+    explicit OutputFile(fs::path path) : path(std::move(path)) {
+      // start off empty, finding out now if it can't be written at all
+      if (not std::ofstream(this->path, std::ios::binary))
+        throw kn::Error("error: unable to write " + this->path.string());
+    }
+    ~OutputFile() override { sync(); }
+
+  protected:
+    int_type overflow(int_type c) override {
+      if (buffer.empty()) {
+        buffer.resize(16 * 1024);
+        setp(buffer.data(), buffer.data() + buffer.size());
+      } else if (sync() != 0) {
+        return traits_type::eof();
+      }
+      if (not traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+      }
+      return traits_type::not_eof(c);
+    }
+
+    int sync() override {
+      if (pptr() == pbase())
+        return 0;
+      auto file = std::ofstream(path, std::ios::binary | std::ios::app);
+      file.write(pbase(), pptr() - pbase());
+      setp(buffer.data(), buffer.data() + buffer.size());
+      return file ? 0 : -1;
+    }
+
+  private:
+    fs::path path;
+    std::vector<char> buffer;
+  };
+
+  std::string read_file(const fs::path& path, const char* what) {
+    auto file = std::ifstream(path, std::ios::binary);
+    if (not file)
+      throw kn::Error("error: unable to read " + std::string(what) + " " + path.string());
+    return std::string(std::istreambuf_iterator<char>(file), {});
+  }
+
+  int open_input(const fs::path& path) {
+#ifdef _WIN32
+    return ::_wopen(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    return ::open(path.c_str(), O_RDONLY);
+#endif
+  }
+
+  void close_input(int fd) {
+#ifdef _WIN32
+    ::_close(fd);
+#else
+    ::close(fd);
+#endif
+  }
+
+  // run a single script in a fresh interpreter on the current thread
+  int run_job(const Job& job, const fs::path& out_dir, std::size_t eval_cache) {
+    auto name = job.script.stem().string();
+    auto out = std::ofstream(out_dir / (name + ".out"), std::ios::binary);
+
+    // inputs are small enough to just read in up front
+    auto data = std::string{};
+    if (not job.input.empty()) {
+      auto file = std::ifstream(job.input, std::ios::binary);
+      data.assign(std::istreambuf_iterator<char>(file), {});
+    }
+    auto in = kn::eval::Input(data);
+
+    auto env = kn::eval::Environment{};
+    env.set_io(in, out);
+    env.evals().set_capacity(eval_cache);
+
+    auto status = 1;
+    try {
+      auto current = kn::eval::CurrentEnvironment(env);
+      auto file = std::ifstream(job.script, std::ios::binary);
+      auto source = std::string(std::istreambuf_iterator<char>(file), {});
+      if (source.empty())
+        throw kn::Error("no input");
+
+      auto parsed = kn::parser::parse(source);
+      auto program = kn::ir::optimise(parsed);
+      auto bytecode = kn::eval::prepare(program);
+      if (bytecode.empty())
+        throw kn::Error("no input");
+      status = kn::eval::run(bytecode);
+    } catch (const std::exception& err) {
+      // anything going wrong is this script's problem alone
+      out << err.what() << '\n';
+    }
+
+    std::ofstream(out_dir / (name + ".status")) << status << '\n';
+    return status;
+  }
+
+  std::vector<Result> run_pool(
+    const std::vector<Job>& jobs, const fs::path& out_dir,
+    std::size_t num_workers, std::size_t eval_cache)
+  {
+    using clock = std::chrono::steady_clock;
+    using ms = std::chrono::duration<double, std::milli>;
+
+    if (num_workers == 0)
+      num_workers = std::max(1u, std::thread::hardware_concurrency());
+    num_workers = std::min(num_workers, std::max<std::size_t>(jobs.size(), 1));
+
+    // deal the jobs out round-robin; idle workers steal from the others
+    auto queues = std::vector<WorkQueue>(num_workers);
+    for (std::size_t i = 0; i < jobs.size(); ++i)
+      queues[i % num_workers].push(i);
+
+    auto results = std::vector<Result>(jobs.size());
+
+    // all jobs are queued up front, so once every queue is empty we're done
+    const auto worker = [&](std::size_t self) {
+      for (;;) {
+        auto job = queues[self].pop();
+        for (std::size_t i = 1; not job and i < num_workers; ++i)
+          job = queues[(self + i) % num_workers].steal();
+        if (not job)
+          return;
+
+        auto start = clock::now();
+        results[*job].status = run_job(jobs[*job], out_dir, eval_cache);
+        results[*job].latency = ms(clock::now() - start).count();
+      }
+    };
+
+    auto threads = std::vector<std::thread>{};
+    for (std::size_t i = 1; i < num_workers; ++i)
+      threads.emplace_back(worker, i);
+    worker(0);
+    for (auto& t : threads)
+      t.join();
+
+    return results;
+  }
+
+  // run everything interleaved on this thread; since the scripts all start
+  // together, latency here is the time until each one finishes
+  std::vector<Result> run_green(
+    const std::vector<Job>& jobs, const fs::path& out_dir,
+    std::size_t slice, std::size_t eval_cache)
+  {
+    using clock = std::chrono::steady_clock;
+    using ms = std::chrono::duration<double, std::milli>;
+
+    // nothing is kept open for a script besides any input that has to be
+    // waited on, so the number of scripts isn't limited by file descriptors
+    struct Files {
+      explicit Files(const fs::path& out_path) : buffer(out_path), out(&buffer) {}
+
+      OutputFile buffer;
+      std::ostream out;
+      int fd = -1;
+    };
+
+    auto start = clock::now();
+    auto results = std::vector<Result>(jobs.size());
+    auto files = std::vector<std::unique_ptr<Files>>(jobs.size());
+    auto sched = kn::eval::Scheduler(slice, eval_cache);
+    auto task_jobs = std::vector<std::size_t>{};
+
+    const auto finish = [&](std::size_t job, int status) {
+      auto& f = *files[job];
+      results[job] = { status, ms(clock::now() - start).count() };
+      std::ofstream(out_dir / (jobs[job].script.stem().string() + ".status"))
+        << status << '\n';
+      if (f.fd >= 0)
+        close_input(f.fd);
+      files[job].reset();
+    };
+
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+      auto name = jobs[i].script.stem().string();
+      files[i] = std::make_unique<Files>(out_dir / (name + ".out"));
+      auto& f = *files[i];
+
+      try {
+        // ordinary files can be read up front, but something like a pipe
+        // has to be waited on as its input arrives
+        auto data = std::string{};
+        if (const auto& input = jobs[i].input; not input.empty()) {
+          if (fs::is_regular_file(input))
+            data = read_file(input, "input");
+          else if (f.fd = open_input(input); f.fd < 0)
+            throw kn::Error("error: unable to read input " + input.string());
+        }
+
+        auto source = read_file(jobs[i].script, "script");
+        if (source.empty())
+          throw kn::Error("no input");
+        [[maybe_unused]] auto id = sched.spawn(source, f.fd, f.out, data);
+        assert(id == task_jobs.size());
+        task_jobs.push_back(i);
+      } catch (const std::exception& err) {
+        f.out << err.what() << '\n';
+        finish(i, 1);
+      }
+    }
+
+    sched.run([&](kn::eval::Scheduler::TaskId id, int status) {
+      finish(task_jobs[id], status);
+    });
+
+    return results;
+  }
+
+  void print_summary(std::ostream& os, std::vector<Result> results, double elapsed) {
+    auto failed = std::count_if(results.begin(), results.end(), [](const Result& r) {
+      return r.status != 0;
+    });
+    std::sort(results.begin(), results.end(), [](const Result& a, const Result& b) {
+      return a.latency < b.latency;
+    });
+    const auto percentile = [&results](double p) {
+      auto i = static_cast<std::size_t>(p * static_cast<double>(results.size() - 1));
+      return results[i].latency;
+    };
+
+    os << std::fixed << std::setprecision(4);
+    os << "scripts:                 " << std::setw(12) << results.size()
+       << " (" << failed << " non-zero exit)\n";
+    os << "wall time:               " << std::setw(12) << elapsed << "ms\n";
+    os << "throughput:              " << std::setw(12)
+       << static_cast<double>(results.size()) / (elapsed / 1000)
+       << " scripts/s\n";
+    if (results.empty())
+      return;
+    os << "latency p50:             " << std::setw(12) << percentile(0.50) << "ms\n";
+    os << "latency p90:             " << std::setw(12) << percentile(0.90) << "ms\n";
+    os << "latency p99:             " << std::setw(12) << percentile(0.99) << "ms\n";
+    os << "latency max:             " << std::setw(12) << results.back().latency << "ms\n";
+  }
+
+}
+
+namespace kn::batch {
+
+  int run(const Options& opts) {
+    using clock = std::chrono::steady_clock;
+    using ms = std::chrono::duration<double, std::milli>;
+
+    auto jobs = collect_jobs(opts.source);
+    auto out_dir = fs::path(opts.out_dir);
+    fs::create_directories(out_dir);
+
+    auto start = clock::now();
+    auto results = opts.green
+      ? run_green(jobs, out_dir, opts.slice, opts.eval_cache)
+      : run_pool(jobs, out_dir, opts.jobs, opts.eval_cache);
+    auto elapsed = ms(clock::now() - start).count();
+
+    print_summary(std::cerr, std::move(results), elapsed);
+    return 0;
+  }
+
+}
@@ -0,0 +1,32 @@
+#ifndef KNIGHT_BATCH_HPP_INCLUDED
+#define KNIGHT_BATCH_HPP_INCLUDED
+
+#include <cstddef>
+#include <string>
+
+#include "cache.hpp"
+
+namespace kn::batch {
+
+  struct Options {
+    // either a directory of `.kn` scripts, or a manifest file where
+    // each line is `<script> [<input>]` relative to the manifest
+    std::string source;
+    // where to write `<name>.out` and `<name>.status` for each script
+    std::string out_dir = ".";
+    // number of worker threads; zero picks one per hardware thread
+    std::size_t jobs = 0;
+    // instead, interleave every script on a single thread, switching
+    // every `slice` instructions or when one is waiting on its input
+    bool green = false;
+    std::size_t slice = 10000;
+    // how many code points each script's EVAL can keep around
+    std::size_t eval_cache = kn::eval::EvalCache::default_capacity;
+  };
+
+  // run every script in the batch, printing a summary to stderr
+  int run(const Options& opts);
+
+}
+
+#endif  // KNIGHT_BATCH_HPP_INCLUDED
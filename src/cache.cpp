@@ -0,0 +1,119 @@
+#include "cache.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace kn::eval {
+
+  EvalCache::EvalCache(std::size_t capacity)
+    : lru()
+    , index()
+    , free()
+    , used(0)
+    , m_capacity(capacity)
+    , m_stats()
+  {}
+
+  EvalCache::EvalCache(const EvalCache& other)
+    : lru(other.lru)
+    , index()
+    , free(other.free)
+    , used(other.used)
+    , m_capacity(other.m_capacity)
+    , m_stats(other.m_stats)
+  {
+    reindex();
+  }
+
+  EvalCache& EvalCache::operator=(const EvalCache& other) {
+    if (this != &other) {
+      lru = other.lru;
+      free = other.free;
+      used = other.used;
+      m_capacity = other.m_capacity;
+      m_stats = other.m_stats;
+      reindex();
+    }
+    return *this;
+  }
+
+  std::optional<EvalCache::Entry> EvalCache::find(std::string_view code) {
+    auto it = index.find(code);
+    if (it == index.end()) {
+      ++m_stats.misses;
+      return std::nullopt;
+    }
+    ++m_stats.hits;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->entry;
+  }
+
+  std::size_t EvalCache::allocate(
+    std::size_t size, std::size_t code_end, const InUse& in_use)
+  {
+    if (used + size > m_capacity)
+      evict(in_use, size);
+
+    // first fit, keeping whatever is left over for next time
+    for (auto it = free.begin(); it != free.end(); ++it) {
+      if (auto& [start, length] = *it; length >= size) {
+        auto result = start;
+        start += size;
+        length -= size;
+        if (length == 0)
+          free.erase(it);
+        return result;
+      }
+    }
+    return code_end;
+  }
+
+  void EvalCache::insert(std::string code, Entry entry) {
+    lru.push_front({ std::move(code), entry });
+    [[maybe_unused]] auto [_, s] = index.emplace(lru.front().code, lru.begin());
+    assert(s);
+    used += entry.size;
+  }
+
+  void EvalCache::evict(const InUse& in_use, std::size_t wanted) {
+    auto it = lru.end();
+    while (it != lru.begin() and used + wanted > m_capacity) {
+      --it;
+      const auto& entry = it->entry;
+      if (entry.pinned or in_use(entry.start, entry.start + entry.size))
+        continue;
+
+      release(entry.start, entry.size);
+      used -= entry.size;
+      ++m_stats.evictions;
+      index.erase(it->code);
+      it = lru.erase(it);
+    }
+  }
+
+  void EvalCache::release(std::size_t start, std::size_t size) {
+    auto next = std::lower_bound(free.begin(), free.end(),
+      std::pair{ start, std::size_t{ 0 } });
+    next = free.insert(next, { start, size });
+
+    // merge with the neighbours so that larger code can fit later
+    if (auto after = next + 1;
+        after != free.end() and next->first + next->second == after->first) {
+      next->second += after->second;
+      free.erase(after);
+    }
+    if (next != free.begin()) {
+      if (auto before = next - 1; before->first + before->second == next->first) {
+        before->second += next->second;
+        free.erase(next);
+      }
+    }
+  }
+
+  void EvalCache::reindex() {
+    index.clear();
+    for (auto it = lru.begin(); it != lru.end(); ++it)
+      index.emplace(it->code, it);
+  }
+
+}
@@ -0,0 +1,90 @@
+#ifndef KNIGHT_CACHE_HPP_INCLUDED
+#define KNIGHT_CACHE_HPP_INCLUDED
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace kn::eval {
+
+  // code generated for EVAL strings, kept to a bounded size:
+  // the least recently used entries are evicted to make room, and the
+  // space they took up in the program is handed out again to new code
+  class EvalCache {
+  public:
+    // where some code lives in the program: the BlockData at `start`,
+    // then the rest of its `size` code points
+    struct Entry {
+      std::size_t start;
+      std::size_t size;
+      // defines blocks, which may still be referenced by values anywhere
+      bool pinned;
+    };
+
+    struct Stats {
+      std::size_t hits = 0;
+      std::size_t misses = 0;
+      std::size_t evictions = 0;
+    };
+
+    // whether any of the code in [first, last) may still be running
+    using InUse = std::function<bool(std::size_t first, std::size_t last)>;
+
+    static constexpr std::size_t default_capacity = std::size_t(1) << 20;
+
+    EvalCache() : EvalCache(default_capacity) {}
+    explicit EvalCache(std::size_t capacity);
+    EvalCache(const EvalCache& other);
+    EvalCache(EvalCache&&) = default;
+    EvalCache& operator=(const EvalCache& other);
+    EvalCache& operator=(EvalCache&&) = default;
+
+    // the code generated for `code`, if still around
+    std::optional<Entry> find(std::string_view code);
+
+    // pick somewhere for `size` code points of new code to go, evicting
+    // if we're over capacity; anything at or past `code_end` is appended
+    std::size_t allocate(std::size_t size, std::size_t code_end, const InUse& in_use);
+    void insert(std::string code, Entry entry);
+
+    // visit every entry, least recently used first
+    template <typename F>
+    void for_each(F&& f) const {
+      for (auto it = lru.rbegin(); it != lru.rend(); ++it)
+        f(it->code, it->entry);
+    }
+
+    std::size_t size() const noexcept { return lru.size(); }
+    std::size_t capacity() const noexcept { return m_capacity; }
+    void set_capacity(std::size_t capacity) noexcept { m_capacity = capacity; }
+    const Stats& stats() const noexcept { return m_stats; }
+
+  private:
+    struct Node {
+      std::string code;
+      Entry entry;
+    };
+
+    void evict(const InUse& in_use, std::size_t wanted);
+    void release(std::size_t start, std::size_t size);
+    void reindex();
+
+    // most recently used first; the index refers into the nodes' strings
+    std::list<Node> lru;
+    std::unordered_map<std::string_view, std::list<Node>::iterator> index;
+    // unused regions of the program as (start, size), sorted by start
+    std::vector<std::pair<std::size_t, std::size_t>> free;
+    std::size_t used;
+    std::size_t m_capacity;
+    Stats m_stats;
+  };
+
+}
+
+#endif  // KNIGHT_CACHE_HPP_INCLUDED
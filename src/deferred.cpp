@@ -0,0 +1,74 @@
+#include "deferred.hpp"
+
+#include <cassert>
+#include <iterator>
+
+#include "ir.hpp"
+
+using namespace kn::eval;
+
+namespace kn::ir {
+
+  ByteCode Deferred::prepare(parser::Program program, std::size_t offset) {
+    // jump targets are only unique within one parse
+    assert(targets.empty());
+    if (program.empty())
+      return {};
+    arena.adopt(std::move(program.arena));
+
+    auto ir = IR{};
+    optimise(program.blocks.front(), ir);
+
+    // the stubs take over the blocks' entry points, so that a block
+    // value always refers to its stub, even once it's been compiled
+    auto entries = std::vector<std::size_t>{};
+    for (auto it = program.blocks.begin() + 1; it != program.blocks.end(); ++it) {
+      auto entry = std::next(it->begin());
+      assert(it->front().op() == OpCode::BlockData and entry->op() == OpCode::Label);
+      entries.push_back(entry->label(0).id());
+
+      ir.emplace_back(OpCode::BlockData);
+      ir.emplace_back(Label::from_constant(0));
+      ir.emplace_back(OpCode::Label);
+      ir.emplace_back(entry->label(0));
+      ir.emplace_back(OpCode::Compile);
+      ir.emplace_back(Label::from_constant(blocks.size()));
+      blocks.push_back(std::move(*it));
+    }
+
+    auto code = eval::prepare(ir, offset, targets);
+    for (auto entry : entries)
+      stubs.push_back(targets[entry] - 2);
+    return code;
+  }
+
+  std::size_t Deferred::compile(ByteCode& code, std::size_t block) {
+    assert(not blocks[block].empty());
+    auto ir = IR{};
+    optimise(blocks[block], ir);
+    blocks[block] = {};
+
+    // leave out the entry point, which is the stub's
+    assert(ir[2].op == OpCode::Label);
+    ir.erase(ir.begin() + 2, ir.begin() + 4);
+
+    auto start = code.size();
+    auto body = eval::prepare(ir, start, targets);
+    code.insert(code.end(), body.begin(), body.end());
+
+    auto stub = stubs[block];
+    assert(code[stub + 2].op == OpCode::Compile);
+    code[stub + 1] = code[start + 1];
+    code[stub + 2] = CodePoint(OpCode::Jump);
+    code[stub + 3] = CodePoint(Label(LabelCat::JumpTarget, start + 2));
+    return start + 2;
+  }
+
+  void Deferred::compile_all(ByteCode& code) {
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+      if (not blocks[i].empty())
+        compile(code, i);
+    }
+  }
+
+}
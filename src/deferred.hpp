@@ -0,0 +1,45 @@
+#ifndef KNIGHT_DEFERRED_HPP_INCLUDED
+#define KNIGHT_DEFERRED_HPP_INCLUDED
+
+#include <cstddef>
+#include <vector>
+
+#include "arena.hpp"
+#include "eval.hpp"
+#include "parser.hpp"
+
+namespace kn::ir {
+
+  // a program whose BLOCKs are only optimised and prepared the first time
+  // they're called; until then, each is a stub which compiles it
+  //
+  // stub structure:
+  //   blockdata 0
+  //   compile <block>
+  // which once compiled becomes:
+  //   blockdata <temporaries>
+  //   jump <body>
+  class Deferred {
+  public:
+    // prepare the start of `program` to go at `offset`, with a stub for
+    // each of its blocks after it; anything calling them has to run with
+    // this as the environment's `deferred`
+    eval::ByteCode prepare(parser::Program program, std::size_t offset);
+
+    // append the code for `block` to `code` and point its stub at it,
+    // giving the address of the block's first instruction
+    std::size_t compile(eval::ByteCode& code, std::size_t block);
+    // compile every block that's still waiting
+    void compile_all(eval::ByteCode& code);
+
+  private:
+    parser::Arena arena;
+    // emptied once they're compiled
+    std::vector<parser::Block> blocks;
+    std::vector<std::size_t> stubs;
+    std::vector<std::size_t> targets;
+  };
+
+}
+
+#endif  // KNIGHT_DEFERRED_HPP_INCLUDED
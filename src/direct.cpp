@@ -0,0 +1,305 @@
+#include "direct.hpp"
+
+#include <cassert>
+#include <vector>
+
+#include "env.hpp"
+#include "error.hpp"
+#include "lexer.hpp"
+
+using namespace kn::eval;
+using env = kn::eval::Environment;
+
+namespace {
+
+  // an expression still waiting on some of its arguments
+  struct Frame {
+    char func;
+    int arity;
+    int num_args;
+    Label children[kn::parser::max_arity];
+
+    // somewhere to put the result, when it's needed before the end
+    Label result;
+    // the address the code for this starts at, where relevant
+    std::size_t start;
+    // a jump whose target is still to be filled in
+    std::size_t patch;
+
+    void add_child(Label child) noexcept {
+      assert(num_args < arity);
+      children[num_args++] = child;
+    }
+    bool is_completed() const noexcept {
+      return num_args == arity;
+    }
+  };
+
+  OpCode opcode(char func) noexcept {
+    switch (func) {
+    case 'P': return OpCode::Prompt;
+    case 'R': return OpCode::Random;
+    case 'E': return OpCode::Eval;
+    case 'C': return OpCode::Call;
+    case '`': return OpCode::Shell;
+    case 'Q': return OpCode::Quit;
+    case '!': return OpCode::Negate;
+    case 'L': return OpCode::Length;
+    case 'D': return OpCode::Dump;
+    case 'O': return OpCode::Output;
+    case '+': return OpCode::Plus;
+    case '-': return OpCode::Minus;
+    case '*': return OpCode::Multiplies;
+    case '/': return OpCode::Divides;
+    case '%': return OpCode::Modulus;
+    case '^': return OpCode::Exponent;
+    case '<': return OpCode::Less;
+    case '>': return OpCode::Greater;
+    case '?': return OpCode::Equals;
+    case 'G': return OpCode::Get;
+    case 'S': return OpCode::Substitute;
+    }
+    assert(false);
+    return OpCode::NumberOfOps;
+  }
+
+  // writes out the bytecode for each expression as soon as its arguments
+  // are in; everything before an argument has been written by the time
+  // it's started, so control flow only needs its forward jumps patched
+  class Emitter {
+  public:
+    Emitter() {
+      // the number of temporaries is filled in at the end
+      code.emplace_back(OpCode::BlockData);
+      code.emplace_back(Label{});
+    }
+
+    // called once `frame` has been pushed
+    void open(Frame& frame) {
+      switch (frame.func) {
+      case 'W':
+        frame.start = code.size();
+        break;
+      case 'B':
+        // the body goes inline, with a jump over it
+        frame.patch = forward(OpCode::Jump);
+        op(OpCode::BlockData, Label{});
+        frame.start = code.size();
+        temps.push_back(0);
+        break;
+      }
+    }
+
+    // called each time `frame` is given an argument
+    void argument(Frame& frame) {
+      auto i = frame.num_args - 1;
+      auto& x = frame.children[i];
+      switch (frame.func) {
+      case '+': case '-': case '*': case '/': case '%':
+      case '^': case '<': case '>': case '?':
+        if (i == 0) cache(x);
+        break;
+      case 'G':
+        if (i < 2) cache(x);
+        break;
+      case 'S':
+        if (i < 3) cache(x);
+        break;
+      case '&':
+      case '|':
+        if (i == 0) {
+          frame.result = new_temp();
+          op(OpCode::Assign, frame.result, x);
+          frame.patch = forward(
+            frame.func == '&' ? OpCode::JumpIfNot : OpCode::JumpIf, x);
+        }
+        break;
+      case 'W':
+        if (i == 0)
+          frame.patch = forward(OpCode::JumpIfNot, x);
+        break;
+      case 'I':
+        if (i == 0) {
+          frame.patch = forward(OpCode::JumpIfNot, x);
+        } else if (i == 1) {
+          frame.result = new_temp();
+          op(OpCode::Assign, frame.result, x);
+          auto end = forward(OpCode::Jump);
+          patch(frame.patch);
+          frame.patch = end;
+        }
+        break;
+      }
+    }
+
+    // called once `frame` has all its arguments, giving its result
+    Label close(Frame& frame) {
+      auto& x = frame.children;
+      switch (frame.func) {
+      case 'T': return env::get().get_literal(true);
+      case 'F': return env::get().get_literal(false);
+      case 'N': return env::get().get_literal(Null{});
+      case ';': return x[1];
+      case '&':
+      case '|':
+        op(OpCode::Assign, frame.result, x[1]);
+        patch(frame.patch);
+        return frame.result;
+      case 'W':
+        op(OpCode::Jump, Label(LabelCat::JumpTarget, frame.start));
+        patch(frame.patch);
+        return env::get().get_literal(Null{});
+      case 'I':
+        op(OpCode::Assign, frame.result, x[2]);
+        patch(frame.patch);
+        return frame.result;
+      case 'B':
+        op(OpCode::Return, x[0]);
+        code[frame.start - 1] = CodePoint(Label::from_constant(pop_frame()));
+        patch(frame.patch);
+        ++blocks;
+        return Label(LabelCat::JumpTarget, frame.start);
+      case '=':
+        // must be an identifier
+        assert(x[0].cat() == LabelCat::Variable);
+        op(OpCode::Assign, x[0], x[1]);
+        return x[0];
+      case 'O':
+      case 'D':
+      case 'Q':
+        op(opcode(frame.func), x[0]);
+        return env::get().get_literal(Null{});
+      }
+
+      auto result = new_temp();
+      code.emplace_back(opcode(frame.func));
+      code.emplace_back(result);
+      for (int i = 0; i < frame.arity; ++i)
+        code.emplace_back(x[i]);
+      return result;
+    }
+
+    kn::parser::Compiled finish(Label result) {
+      op(OpCode::Return, result);
+      code[1] = CodePoint(Label::from_constant(pop_frame()));
+      assert(temps.empty());
+      return { std::move(code), blocks };
+    }
+
+  private:
+    template <typename... Args>
+    void op(OpCode op, Args... labels) {
+      code.emplace_back(op);
+      (code.emplace_back(labels), ...);
+    }
+
+    // a jump to somewhere not yet written; gives where to patch it
+    template <typename... Args>
+    std::size_t forward(OpCode jump, Args... labels) {
+      code.emplace_back(jump);
+      auto at = code.size();
+      code.emplace_back(Label{});
+      (code.emplace_back(labels), ...);
+      return at;
+    }
+
+    // point the jump at `at` to the next instruction
+    void patch(std::size_t at) noexcept {
+      code[at] = CodePoint(Label(LabelCat::JumpTarget, code.size()));
+    }
+
+    // if the argument is a variable, it could change before it's used
+    // by a later argument; take a copy to keep the evaluation order
+    void cache(Label& x) {
+      if (x.cat() == LabelCat::Variable) {
+        auto copy = new_temp();
+        op(OpCode::Assign, copy, x);
+        x = copy;
+      }
+    }
+
+    Label new_temp() noexcept {
+      assert(not temps.empty());
+      return { LabelCat::Temporary, temps.back()++ };
+    }
+    std::size_t pop_frame() noexcept {
+      auto num_temps = temps.back();
+      temps.pop_back();
+      return num_temps;
+    }
+
+    ByteCode code;
+    std::vector<std::size_t> temps = { 0 };
+    std::size_t blocks = 0;
+  };
+
+}
+
+namespace kn::parser {
+
+  Compiled compile(std::string_view source, Literals literals) {
+    auto lexer = kn::lexer::Lexer(source);
+    auto tok = lexer.next();
+    if (not tok)
+      return {};
+
+    auto emitter = Emitter{};
+    auto& env = eval::Environment::get();
+
+    // initialize the stack with a no-op
+    std::vector<Frame> stack;
+    stack.push_back({ 0, 1, 0, {}, {}, 0, 0 });
+
+    const auto add_child = [&](Label child) {
+      stack.back().add_child(child);
+      emitter.argument(stack.back());
+    };
+
+    for (; tok; tok = lexer.next()) {
+      auto it = &*tok;
+      if (auto s = it->as_string_lit()) {
+        if (literals == Literals::Borrow)
+          add_child(env.get_borrowed_literal(s->data, s->hash));
+        else
+          add_child(env.get_string_literal(s->data, s->hash));
+      }
+      else if (auto n = it->as_numeric_lit()) {
+        add_child(eval::Label::from_constant(n->data));
+      }
+      else if (auto i = it->as_ident()) {
+        add_child(env.get_variable(i->name, i->hash));
+      }
+      else if (auto f = it->as_function()) {
+        auto n = arity(f->id);
+        if (n < 0)
+          throw kn::Error(lexer.range(*it), "error: unknown function");
+        auto frame = Frame{ f->id, n, 0, {}, {}, 0, 0 };
+        if (n == 0) {
+          add_child(emitter.close(frame));
+        } else {
+          stack.push_back(frame);
+          emitter.open(stack.back());
+        }
+      }
+      else {
+        throw kn::Error(lexer.range(*it), "error: unknown token type");
+      }
+
+      // fold in completed expressions
+      while (stack.back().is_completed()) {
+        if (stack.size() == 1) {
+          // hit bottom of stack, we're done
+          if (auto junk = lexer.next())
+            throw kn::Error(lexer.range(*junk).first, "error: unparsed tokens");
+          return emitter.finish(stack.back().children[0]);
+        }
+        auto result = emitter.close(stack.back());
+        stack.pop_back();
+        add_child(result);
+      }
+    }
+
+    throw kn::Error("error: unexpected EOF");
+  }
+
+}
@@ -0,0 +1,27 @@
+#ifndef KNIGHT_DIRECT_HPP_INCLUDED
+#define KNIGHT_DIRECT_HPP_INCLUDED
+
+#include <cstddef>
+#include <string_view>
+
+#include "eval.hpp"
+#include "parser.hpp"
+
+namespace kn::parser {
+
+  struct Compiled {
+    eval::ByteCode code = {};
+    // how many BLOCKs it defines, besides the program itself
+    std::size_t blocks = 0;
+
+    bool empty() const noexcept { return code.empty(); }
+  };
+
+  // compile `source` straight to bytecode in one pass, skipping the IR and
+  // any optimisation; jumps are relative to the start of the code, so it
+  // has to be relocated to wherever it ends up being run
+  Compiled compile(std::string_view source, Literals literals = Literals::Copy);
+
+}
+
+#endif  // KNIGHT_DIRECT_HPP_INCLUDED
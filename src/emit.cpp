@@ -1,9 +1,15 @@
 #include "emit.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <optional>
+#include <string_view>
+#include <vector>
 
 #include "env.hpp"
+#include "error.hpp"
 #include "eval.hpp"
+#include "lexer.hpp"
 
 using namespace kn::eval;
 using namespace kn::parser;
@@ -14,7 +20,7 @@ namespace {
   Emitted& cache_expr(Emitted& expr, ParseInfo& info) {
     if (expr.result.cat() == LabelCat::Variable) {
       auto cache = info.new_temp();
-      expr.instructions.emplace_back(OpCode::Assign, cache, expr.result);
+      expr.instructions.push_back(info.op(OpCode::Assign, cache, expr.result));
       expr.result = cache;
     }
     return expr;
@@ -25,16 +31,16 @@ namespace {
     auto& x = ast.children[0];
 
     auto result = info.new_temp();
-    x.instructions.emplace_back(op, result, x.result);
+    x.instructions.push_back(info.op(op, result, x.result));
     return { result, std::move(x.instructions) };
   }
 
-  Emitted gen_onearg_noreturn(ASTFrame&& ast, OpCode op) {
+  Emitted gen_onearg_noreturn(ASTFrame&& ast, ParseInfo& info, OpCode op) {
     assert(ast.arity == 1);
     auto& x = ast.children[0];
 
     auto result = env::get().get_literal(Null{});
-    x.instructions.emplace_back(op, x.result);
+    x.instructions.push_back(info.op(op, x.result));
     return { result, std::move(x.instructions) };
   }
 
@@ -47,10 +53,8 @@ namespace {
     auto& rhs = ast.children[1];
 
     auto result = info.new_temp();
-    lhs.instructions.insert(
-      lhs.instructions.end(),
-      rhs.instructions.begin(), rhs.instructions.end());
-    lhs.instructions.emplace_back(op, result, lhs.result, rhs.result);
+    lhs.instructions.splice(std::move(rhs.instructions));
+    lhs.instructions.push_back(info.op(op, result, lhs.result, rhs.result));
     return { result, std::move(lhs.instructions) };
   }
 
@@ -64,17 +68,46 @@ namespace {
     auto finish = info.new_jump();
     auto result = info.new_temp();
 
-    lhs.instructions.emplace_back(OpCode::Assign, result, lhs.result);
-    lhs.instructions.emplace_back(brancher, finish, lhs.result);
-    lhs.instructions.insert(
-      lhs.instructions.end(),
-      rhs.instructions.begin(), rhs.instructions.end());
+    lhs.instructions.push_back(info.op(OpCode::Assign, result, lhs.result));
+    lhs.instructions.push_back(info.op(brancher, finish, lhs.result));
+    lhs.instructions.splice(std::move(rhs.instructions));
     // assign back the result onto the same variable
-    lhs.instructions.emplace_back(OpCode::Assign, result, rhs.result);
-    lhs.instructions.emplace_back(OpCode::Label, finish);
+    lhs.instructions.push_back(info.op(OpCode::Assign, result, rhs.result));
+    lhs.instructions.push_back(info.op(OpCode::Label, finish));
     return { result, std::move(lhs.instructions) };
   }
 
+  // compile the code in a string literal ahead of time, giving the blocks
+  // to add with their jump targets renumbered after any already in use;
+  // nullopt if it doesn't parse, in which case EVAL reports that if it runs
+  std::optional<std::vector<kn::parser::Block>> compile_literal(
+    std::string_view code, ParseInfo& info)
+  {
+    auto program = kn::parser::Program{};
+    try {
+      program = kn::parser::parse(code);
+    } catch (const kn::Error&) {
+      return std::nullopt;
+    }
+    // the instructions have to last as long as ours do
+    info.arena.adopt(std::move(program.arena));
+    auto& blocks = program.blocks;
+
+    auto base = info.jump_labels;
+    for (auto& block : blocks) {
+      for (auto& node : block) {
+        for (std::size_t i = 0; i < num_labels(node.op()); ++i) {
+          auto& label = node.label(i);
+          if (label.cat() == LabelCat::JumpTarget) {
+            label = Label(LabelCat::JumpTarget, base + label.id());
+            info.jump_labels = std::max(info.jump_labels, label.id() + 1);
+          }
+        }
+      }
+    }
+    return std::move(blocks);
+  }
+
 }
 
 namespace kn::parser::emit {
@@ -101,13 +134,13 @@ namespace kn::parser::emit {
   Emitted prompt([[maybe_unused]] ASTFrame ast, ParseInfo& info) {
     assert(ast.arity == 0);
     auto result = info.new_temp();
-    return { result, { Operation(OpCode::Prompt, result) } };
+    return { result, info.op(OpCode::Prompt, result) };
   }
 
   Emitted random([[maybe_unused]] ASTFrame ast, ParseInfo& info) {
     assert(ast.arity == 0);
     auto result = info.new_temp();
-    return { result, { Operation(OpCode::Random, result) } };
+    return { result, info.op(OpCode::Random, result) };
   }
 
 
@@ -127,10 +160,10 @@ namespace kn::parser::emit {
     //   ...
     //   return
 
-    x.instructions.emplace_front(OpCode::Label, entry_point);
-    x.instructions.emplace_back(OpCode::Return, x.result);
+    x.instructions.push_front(info.op(OpCode::Label, entry_point));
+    x.instructions.push_back(info.op(OpCode::Return, x.result));
 
-    x.instructions.emplace_front(OpCode::BlockData, num_temps);
+    x.instructions.push_front(info.op(OpCode::BlockData, num_temps));
 
     info.blocks.emplace_back(std::move(x.instructions));
 
@@ -138,7 +171,32 @@ namespace kn::parser::emit {
   }
 
   Emitted eval(ASTFrame ast, ParseInfo& info) {
-    return gen_onearg(std::move(ast), info, OpCode::Eval); }
+    assert(ast.arity == 1);
+    auto& x = ast.children[0];
+
+    // a string literal is known now, so compile it as a block and call that
+    auto blocks = std::optional<std::vector<kn::parser::Block>>{};
+    if (x.result.cat() == LabelCat::Literal) {
+      if (auto code = env::get().value(x.result); code.is_string())
+        blocks = compile_literal(code.to_string().as_str_view(), info);
+    }
+    if (not blocks)
+      return gen_onearg(std::move(ast), info, OpCode::Eval);
+    if (blocks->empty())
+      return { env::get().get_literal(Null{}), std::move(x.instructions) };
+
+    auto entry_point = info.new_jump();
+    auto& body = blocks->front();
+    assert(body.front().op() == OpCode::BlockData);
+    body.insert_after(body.begin(), info.op(OpCode::Label, entry_point));
+    for (auto& block : *blocks)
+      info.blocks.emplace_back(std::move(block));
+
+    auto result = info.new_temp();
+    x.instructions.push_back(info.op(OpCode::Call, result, entry_point));
+    return { result, std::move(x.instructions) };
+  }
+
   Emitted call(ASTFrame ast, ParseInfo& info) {
     return gen_onearg(std::move(ast), info, OpCode::Call); }
   Emitted shell(ASTFrame ast, ParseInfo& info) {
@@ -148,18 +206,18 @@ namespace kn::parser::emit {
   Emitted length(ASTFrame ast, ParseInfo& info) {
     return gen_onearg(std::move(ast), info, OpCode::Length); }
 
-  Emitted output(ASTFrame ast, ParseInfo&) {
-    return gen_onearg_noreturn(std::move(ast), OpCode::Output); }
-  Emitted dump(ASTFrame ast, ParseInfo&) {
-    return gen_onearg_noreturn(std::move(ast), OpCode::Dump); }
-  Emitted quit(ASTFrame ast, ParseInfo&) {
-    return gen_onearg_noreturn(std::move(ast), OpCode::Quit); }
+  Emitted output(ASTFrame ast, ParseInfo& info) {
+    return gen_onearg_noreturn(std::move(ast), info, OpCode::Output); }
+  Emitted dump(ASTFrame ast, ParseInfo& info) {
+    return gen_onearg_noreturn(std::move(ast), info, OpCode::Dump); }
+  Emitted quit(ASTFrame ast, ParseInfo& info) {
+    return gen_onearg_noreturn(std::move(ast), info, OpCode::Quit); }
 
 
   // arity 2
 
 
-  Emitted assign(ASTFrame ast, ParseInfo&) {
+  Emitted assign(ASTFrame ast, ParseInfo& info) {
     assert(ast.arity == 2);
 
     // must be an identifier, always no instructions
@@ -167,7 +225,7 @@ namespace kn::parser::emit {
     assert(ast.children[0].instructions.empty());
 
     auto& x = ast.children[1];
-    x.instructions.emplace_back(OpCode::Assign, var, x.result);
+    x.instructions.push_back(info.op(OpCode::Assign, var, x.result));
     return { var, std::move(x.instructions) };
   }
 
@@ -176,9 +234,7 @@ namespace kn::parser::emit {
     auto& lhs = ast.children[0];
     auto& rhs = ast.children[1];
 
-    lhs.instructions.insert(
-      lhs.instructions.end(),
-      rhs.instructions.begin(), rhs.instructions.end());
+    lhs.instructions.splice(std::move(rhs.instructions));
     return { rhs.result, std::move(lhs.instructions) };
   }
 
@@ -190,13 +246,11 @@ namespace kn::parser::emit {
     auto start = info.new_jump();
     auto finish = info.new_jump();
 
-    cond.instructions.emplace_front(OpCode::Label, start);
-    cond.instructions.emplace_back(OpCode::JumpIfNot, finish, cond.result);
-    cond.instructions.insert(
-      cond.instructions.end(),
-      loop.instructions.begin(), loop.instructions.end());
-    cond.instructions.emplace_back(OpCode::Jump, start);
-    cond.instructions.emplace_back(OpCode::Label, finish);
+    cond.instructions.push_front(info.op(OpCode::Label, start));
+    cond.instructions.push_back(info.op(OpCode::JumpIfNot, finish, cond.result));
+    cond.instructions.splice(std::move(loop.instructions));
+    cond.instructions.push_back(info.op(OpCode::Jump, start));
+    cond.instructions.push_back(info.op(OpCode::Label, finish));
     return { env::get().get_literal(Null{}), std::move(cond.instructions) };
   }
 
@@ -238,23 +292,19 @@ namespace kn::parser::emit {
     auto end_label = info.new_jump();
     auto result = info.new_temp();
 
-    cond.instructions.emplace_back(OpCode::JumpIfNot, no_label, cond.result);
+    cond.instructions.push_back(info.op(OpCode::JumpIfNot, no_label, cond.result));
 
     // true case
-    cond.instructions.insert(
-      cond.instructions.end(),
-      yes.instructions.begin(), yes.instructions.end());
-    cond.instructions.emplace_back(OpCode::Assign, result, yes.result);
-    cond.instructions.emplace_back(OpCode::Jump, end_label);
+    cond.instructions.splice(std::move(yes.instructions));
+    cond.instructions.push_back(info.op(OpCode::Assign, result, yes.result));
+    cond.instructions.push_back(info.op(OpCode::Jump, end_label));
 
-    cond.instructions.emplace_back(OpCode::Label, no_label);
+    cond.instructions.push_back(info.op(OpCode::Label, no_label));
 
     // false case
-    cond.instructions.insert(
-      cond.instructions.end(),
-      no.instructions.begin(), no.instructions.end());
-    cond.instructions.emplace_back(OpCode::Assign, result, no.result);
-    cond.instructions.emplace_back(OpCode::Label, end_label);
+    cond.instructions.splice(std::move(no.instructions));
+    cond.instructions.push_back(info.op(OpCode::Assign, result, no.result));
+    cond.instructions.push_back(info.op(OpCode::Label, end_label));
 
     return { result, std::move(cond.instructions) };
   }
@@ -269,15 +319,11 @@ namespace kn::parser::emit {
 
     auto result = info.new_temp();
 
-    str.instructions.insert(
-      str.instructions.end(),
-      pos.instructions.begin(), pos.instructions.end());
-    str.instructions.insert(
-      str.instructions.end(),
-      len.instructions.begin(), len.instructions.end());
+    str.instructions.splice(std::move(pos.instructions));
+    str.instructions.splice(std::move(len.instructions));
 
-    str.instructions.emplace_back(
-      OpCode::Get, result, str.result, pos.result, len.result);
+    str.instructions.push_back(info.op(
+      OpCode::Get, result, str.result, pos.result, len.result));
     return { result, std::move(str.instructions) };
   }
 
@@ -296,19 +342,13 @@ namespace kn::parser::emit {
 
     auto result = info.new_temp();
 
-    str.instructions.insert(
-      str.instructions.end(),
-      pos.instructions.begin(), pos.instructions.end());
-    str.instructions.insert(
-      str.instructions.end(),
-      len.instructions.begin(), len.instructions.end());
-    str.instructions.insert(
-      str.instructions.end(),
-      replace.instructions.begin(), replace.instructions.end());
-
-    str.instructions.emplace_back(
+    str.instructions.splice(std::move(pos.instructions));
+    str.instructions.splice(std::move(len.instructions));
+    str.instructions.splice(std::move(replace.instructions));
+
+    str.instructions.push_back(info.op(
       OpCode::Substitute, result,
-      str.result, pos.result, len.result, replace.result);
+      str.result, pos.result, len.result, replace.result));
     return { result, std::move(str.instructions) };
   }
 
@@ -1,26 +1,83 @@
 #include "env.hpp"
+#include <algorithm>
 #include <cassert>
+#include <iostream>
 #include "error.hpp"
 
-#ifdef KN_HAS_DEBUGGER
-#include <iostream>
-#endif
+namespace {
+
+  thread_local kn::eval::Environment* current = nullptr;
+
+  kn::eval::Input& standard_input() {
+    static auto input = kn::eval::Input(0);
+    return input;
+  }
+
+}
 
 namespace kn::eval {
 
   Environment::Environment()
-    : id_map()
+    : variable_ids()
     , values()
     , names()
-    , stringlit_map()
+    , literal_ids()
     , literals{ { Null{} }, { true }, { false } }
     , temporaries()
     , stack()
+    , m_evals()
+    , m_deferred(nullptr)
+    , m_input(&standard_input())
+    , m_output(&std::cout)
+    , m_flush(Flush::AtExit)
+    , m_exit_code()
+    , m_random()
+    , m_shell()
   {}
 
   Environment& Environment::get() {
-    static Environment env;
-    return env;
+    if (not current) {
+      thread_local Environment env;
+      current = &env;
+    }
+    return *current;
+  }
+
+  Environment* Environment::swap_current(Environment* env) noexcept {
+    return std::exchange(current, env);
+  }
+
+  Environment::Snapshot Environment::snapshot() const {
+    return { variable_ids, values, names, literal_ids, literals, m_evals };
+  }
+
+  void Environment::restore(Snapshot snap) {
+    variable_ids = std::move(snap.variable_ids);
+    values = std::move(snap.values);
+    names = std::move(snap.names);
+    literal_ids = std::move(snap.literal_ids);
+    literals = std::move(snap.literals);
+    m_evals = std::move(snap.evals);
+    temporaries.clear();
+    stack.clear();
+    m_exit_code.reset();
+  }
+
+  void Environment::restore_variables(const Snapshot& snap) {
+    assert(snap.values.size() <= values.size());
+    std::copy(snap.values.begin(), snap.values.end(), values.begin());
+    // anything defined since the snapshot goes back to being undefined
+    auto defined = values.begin() + static_cast<std::ptrdiff_t>(snap.values.size());
+    std::fill(defined, values.end(), std::nullopt);
+    temporaries.clear();
+    stack.clear();
+    m_exit_code.reset();
+  }
+
+  bool Environment::is_running(std::size_t first, std::size_t last) const noexcept {
+    return std::any_of(stack.begin(), stack.end(), [=](const StackFrame& f) {
+      return f.retaddr >= first and f.retaddr < last;
+    });
   }
 
   void Environment::push_frame(
@@ -37,29 +94,39 @@ namespace kn::eval {
     return res;
   }
 
-  Label Environment::get_variable(const std::string& name) {
-    auto [it, inserted] = id_map.try_emplace(name, values.size());
-    if (inserted) {
-      names.push_back(name);
-      values.emplace_back();
-    }
-    return { LabelCat::Variable, it->second };
+  Label Environment::get_variable(std::string_view name) {
+    return get_variable(name, intern_hash(name));
   }
-  Label Environment::get_variable(std::string&& name) {
-    auto [it, inserted] = id_map.try_emplace(name, values.size());
-    if (inserted) {
-      names.push_back(std::move(name));
+  Label Environment::get_variable(std::string_view name, std::size_t hash) {
+    auto id = variable_ids.intern(name, hash, values.size(),
+      [this](std::size_t i) { return std::string_view(names[i]); });
+    if (id == values.size()) {
+      names.emplace_back(name);
       values.emplace_back();
     }
-    return { LabelCat::Variable, it->second };
+    return { LabelCat::Variable, id };
   }
 
-  Label Environment::get_string_literal(std::string s) {
-    auto [it, inserted] = stringlit_map.try_emplace(s, literals.size());
-    if (inserted) {
-      literals.emplace_back(String(std::move(s)));
-    }
-    return { LabelCat::Literal, it->second };
+  std::size_t Environment::intern_literal(std::string_view s, std::size_t hash) {
+    return literal_ids.intern(s, hash, literals.size(),
+      [this](std::size_t i) { return literals[i].as_string()->as_str_view(); });
+  }
+
+  Label Environment::get_string_literal(std::string_view s) {
+    return get_string_literal(s, intern_hash(s));
+  }
+  Label Environment::get_string_literal(std::string_view s, std::size_t hash) {
+    auto id = intern_literal(s, hash);
+    if (id == literals.size())
+      literals.emplace_back(String(s));
+    return { LabelCat::Literal, id };
+  }
+
+  Label Environment::get_borrowed_literal(std::string_view s, std::size_t hash) {
+    auto id = intern_literal(s, hash);
+    if (id == literals.size())
+      literals.emplace_back(String::borrow(s));
+    return { LabelCat::Literal, id };
   }
 
   Label Environment::get_literal(Boolean b) const noexcept {
@@ -83,6 +150,15 @@ namespace kn::eval {
   }
 
   const Value& Environment::value(Label v) const {
+    const auto& x = peek(v);
+    if (x.is_pending()) {
+      // waiting changes how the value is held, not what it is
+      const_cast<Value&>(x).resolve();
+    }
+    return x;
+  }
+
+  const Value& Environment::peek(Label v) const {
     assert(v.needs_eval());
     if (v.cat() == LabelCat::Variable) {
       if (not values[v.id()]) {
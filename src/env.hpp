@@ -1,31 +1,118 @@
 #ifndef KNIGHT_ENV_HPP_INCLUDED
 #define KNIGHT_ENV_HPP_INCLUDED
 
+#include <memory>
 #include <optional>
+#include <ostream>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <utility>
 #include <vector>
 
+#include "cache.hpp"
 #include "eval.hpp"
+#include "input.hpp"
+#include "intern.hpp"
+#include "random.hpp"
 #include "value.hpp"
 
+namespace kn::funcs {
+  class ShellSession;
+}
+
+namespace kn::ir {
+  class Deferred;
+}
+
 namespace kn::eval {
 
   class Environment {
-  private:
+  public:
     Environment();
+    Environment(const Environment&) = delete;
+    Environment& operator=(const Environment&) = delete;
 
-  public:
+    // the environment of the interpreter running on this thread
     static Environment& get();
+    // make `env` current for this thread, returning the previous one
+    static Environment* swap_current(Environment* env) noexcept;
+
+    // streams used for PROMPT and OUTPUT
+    Input& input() const noexcept { return *m_input; }
+    std::ostream& output() const noexcept { return *m_output; }
+    void set_io(Input& in, std::ostream& out) noexcept {
+      m_input = &in;
+      m_output = &out;
+    }
+
+    // when OUTPUT is pushed out, besides whenever the stream fills up
+    enum class Flush {
+      // only once the program is done with it
+      AtExit,
+      // also before PROMPT and SHELL, in case someone is waiting on it
+      BeforeInput,
+      // also after every OUTPUT
+      EveryLine,
+    };
+    Flush flush_policy() const noexcept { return m_flush; }
+    void set_flush_policy(Flush flush) noexcept { m_flush = flush; }
+    // flush the output if the policy asks for it at `point`
+    void flush_output(Flush point) const {
+      if (m_flush >= point)
+        m_output->flush();
+    }
+
+    // the generator for RANDOM
+    Random& random() noexcept { return m_random; }
+
+    // the shell SHELL sends its commands to, when one is kept around;
+    // started on first use, and never shared with other environments
+    std::shared_ptr<funcs::ShellSession>& shell() noexcept { return m_shell; }
+
+    // status set by QUIT, if it has been called
+    std::optional<int> exit_code() const noexcept { return m_exit_code; }
+    void set_exit_code(int code) noexcept { m_exit_code = code; }
+
+    // the interpreter state at some point, to cheaply start again from;
+    // addresses in it refer to whatever code was running at the time
+    struct Snapshot {
+      Interner variable_ids;
+      std::vector<std::optional<Value>> values;
+      std::vector<std::string> names;
+      Interner literal_ids;
+      std::vector<Value> literals;
+      EvalCache evals;
+    };
+    Snapshot snapshot() const;
+    // restore everything, clearing any frames left behind by QUIT;
+    // code generated since the snapshot must be discarded by the caller
+    void restore(Snapshot snap);
+    // restore just the variable values, keeping code generated since
+    void restore_variables(const Snapshot& snap);
+
+    // code already generated for EVAL strings
+    EvalCache& evals() noexcept { return m_evals; }
+    const EvalCache& evals() const noexcept { return m_evals; }
+
+    // blocks of the running program that are compiled when first called
+    ir::Deferred* deferred() const noexcept { return m_deferred; }
+    void set_deferred(ir::Deferred* deferred) noexcept { m_deferred = deferred; }
+
+    // whether anything in [first, last) is somewhere on the call stack
+    bool is_running(std::size_t first, std::size_t last) const noexcept;
 
     void push_frame(std::size_t retaddr, Label result, std::size_t num_temps);
     std::pair<std::size_t, Label> pop_frame();
 
-    Label get_variable(const std::string& name);
-    Label get_variable(std::string&& name);
+    // each of these can be given the `intern_hash` of the name or
+    // string, if it's already known, to save working it out again
+    Label get_variable(std::string_view name);
+    Label get_variable(std::string_view name, std::size_t hash);
 
-    Label get_string_literal(std::string s);
+    Label get_string_literal(std::string_view s);
+    Label get_string_literal(std::string_view s, std::size_t hash);
+    // the same, but referring to `s` rather than copying it
+    Label get_borrowed_literal(std::string_view s, std::size_t hash);
 
     Label get_literal(Boolean b) const noexcept;
     Label get_literal(Null) const noexcept;
@@ -34,6 +121,8 @@ namespace kn::eval {
 
     bool has_value(Label v) const;
     const Value& value(Label v) const;
+    // the same, but without waiting for a pending result
+    const Value& peek(Label v) const;
     const Value& assign(Label v, Value&& x);
 
 #ifdef KN_HAS_DEBUGGER
@@ -41,12 +130,14 @@ namespace kn::eval {
 #endif
 
   private:
-    std::unordered_map<std::string, std::size_t> id_map;
+    Interner variable_ids;
     std::vector<std::optional<Value>> values;
     std::vector<std::string> names;
 
-    std::unordered_map<std::string, std::size_t> stringlit_map;
+    Interner literal_ids;
     std::vector<Value> literals;
+    // the id of the string literal `s`, or literals.size() if it's new
+    std::size_t intern_literal(std::string_view s, std::size_t hash);
 
     std::vector<std::optional<Value>> temporaries;
 
@@ -61,12 +152,37 @@ namespace kn::eval {
     };
     std::vector<StackFrame> stack;
 
+    EvalCache m_evals;
+    ir::Deferred* m_deferred;
+
+    Input* m_input;
+    std::ostream* m_output;
+    Flush m_flush;
+    std::optional<int> m_exit_code;
+    Random m_random;
+    std::shared_ptr<funcs::ShellSession> m_shell;
+
     auto temps() {
       return temporaries.data() + temporaries.size() - stack.back().num_temps; }
     auto temps() const {
       return temporaries.data() + temporaries.size() - stack.back().num_temps; }
   };
 
+  // makes an environment current on this thread for the guard's lifetime
+  class CurrentEnvironment {
+  public:
+    explicit CurrentEnvironment(Environment& env) noexcept
+      : previous(Environment::swap_current(&env))
+    {}
+    ~CurrentEnvironment() { Environment::swap_current(previous); }
+
+    CurrentEnvironment(const CurrentEnvironment&) = delete;
+    CurrentEnvironment& operator=(const CurrentEnvironment&) = delete;
+
+  private:
+    Environment* previous;
+  };
+
 }
 
 #endif // KNIGHT_ENV_HPP_INCLUDED
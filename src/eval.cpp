@@ -3,9 +3,9 @@
 #include <array>
 #include <cassert>
 #include <deque>
+#include <limits>
 #include <utility>
 #include <vector>
-#include <unordered_map>
 
 #ifdef KN_HAS_DEBUGGER
 #include <cstring>
@@ -24,142 +24,167 @@ namespace {
   using namespace kn::eval;
 
   using op_table = std::array<
-    std::pair<int, std::size_t(*)(ByteCode& bytecode, std::size_t offset)>,
+    std::size_t(*)(ByteCode& bytecode, std::size_t offset),
     static_cast<std::size_t>(OpCode::NumberOfOps)>;
 
-  // TODO: don't split this very particular important information
-  // over like three different files :s
+  // in the same order as `OpCode`, with operands as given by `op_labels`
   inline constexpr auto op_funcs = op_table{{
-    { 0, kn::funcs::no_op },
-    { 1, kn::funcs::error },    // label
-    { 1, kn::funcs::error },    // block_label
-    { 2, kn::funcs::call },
-    { 1, kn::funcs::return_ },
-    { 1, kn::funcs::jump },
-    { 2, kn::funcs::jump_if },
-    { 2, kn::funcs::jump_if_not },
-    { 3, kn::funcs::plus },
-    { 3, kn::funcs::minus },
-    { 3, kn::funcs::multiplies },
-    { 3, kn::funcs::divides },
-    { 3, kn::funcs::modulus },
-    { 3, kn::funcs::exponent },
-    { 2, kn::funcs::negate },
-    { 3, kn::funcs::less },
-    { 3, kn::funcs::greater },
-    { 3, kn::funcs::equals },
-    { 2, kn::funcs::length },
-    { 4, kn::funcs::get },
-    { 5, kn::funcs::substitute },
-    { 2, kn::funcs::assign },
-    { 1, kn::funcs::prompt },
-    { 1, kn::funcs::output },
-    { 1, kn::funcs::random },
-    { 2, kn::funcs::shell },
-    { 1, kn::funcs::quit },
-    { 2, kn::funcs::eval },
-    { 1, kn::funcs::dump },
+    kn::funcs::no_op,
+    kn::funcs::error,    // label
+    kn::funcs::error,    // block_label
+    kn::funcs::call,
+    kn::funcs::return_,
+    kn::funcs::jump,
+    kn::funcs::jump_if,
+    kn::funcs::jump_if_not,
+    kn::funcs::plus,
+    kn::funcs::minus,
+    kn::funcs::multiplies,
+    kn::funcs::divides,
+    kn::funcs::modulus,
+    kn::funcs::exponent,
+    kn::funcs::negate,
+    kn::funcs::less,
+    kn::funcs::greater,
+    kn::funcs::equals,
+    kn::funcs::length,
+    kn::funcs::get,
+    kn::funcs::substitute,
+    kn::funcs::assign,
+    kn::funcs::prompt,
+    kn::funcs::output,
+    kn::funcs::random,
+    kn::funcs::shell,
+    kn::funcs::quit,
+    kn::funcs::eval,
+    kn::funcs::dump,
+    kn::funcs::compile,
   }};
-  constexpr int get_num_labels(OpCode op) noexcept {
-    return op_funcs[static_cast<std::size_t>(op)].first;
-  }
   constexpr auto get_function(OpCode op) noexcept {
-    return op_funcs[static_cast<std::size_t>(op)].second;
+    return op_funcs[static_cast<std::size_t>(op)];
   }
 
-  // map from label ID -> label offset
-  auto labels = std::unordered_map<std::size_t, std::size_t>{};
-
 }
 
 namespace kn::eval {
 
   // prepare the instructions for execution:
-  // remove labels, determine jump offsets, and flatten structure
-  ByteCode prepare(const std::vector<Operation>& program, std::size_t label_offset) {
-    // our new list
-    // potentially overreserve, but we're not super worried about that generally
-    // (the average instruction has one opcode and two labels)
-    auto rewritten = std::vector<CodePoint>{};
-    rewritten.reserve(3 * program.size());
-
-    // map from local offset -> label ID
-    auto local_offsets = std::vector<std::pair<std::size_t, std::size_t>>{};
-
-    for (const auto& op : program) switch (op.op) {
-      case OpCode::Label: {
-        assert(op.labels[0].cat() == LabelCat::JumpTarget);
-        [[maybe_unused]] auto [_, s] = labels.try_emplace(
-          op.labels[0].id(), rewritten.size() + label_offset);
-        assert(s);
-      } break;
-
-      case OpCode::Call: {
-        rewritten.emplace_back(op.op);
-        assert(op.labels[0].cat() != LabelCat::JumpTarget);
-        rewritten.emplace_back(op.labels[0]);
-        if (op.labels[1].cat() == LabelCat::JumpTarget) {
-          local_offsets.emplace_back(rewritten.size(), op.labels[1].id());
-          rewritten.emplace_back(Label{});  // placeholder
-        } else {
-          rewritten.emplace_back(op.labels[1]);
-        }
-      } break;
-
-      case OpCode::Jump:
-      case OpCode::JumpIf:
-      case OpCode::JumpIfNot: {
-        rewritten.emplace_back(op.op);
-        assert(op.labels[0].cat() == LabelCat::JumpTarget);
-        local_offsets.emplace_back(rewritten.size(), op.labels[0].id());
-        rewritten.emplace_back(Label{});  // placeholder
-        if (op.op != OpCode::Jump) {
-          assert(op.labels[1].cat() != LabelCat::JumpTarget);
-          rewritten.emplace_back(op.labels[1]);
-        }
-      } break;
-
-      default: {
-        rewritten.emplace_back(op.op);
-        for (int i = 0; i < get_num_labels(op.op); ++i) {
-          if (op.labels[i].cat() == LabelCat::JumpTarget) {
-            local_offsets.emplace_back(rewritten.size(), op.labels[i].id());
-            rewritten.emplace_back(Label{});  // placeholder
-          } else {
-            rewritten.emplace_back(op.labels[i]);
-          }
-        }
-      } break;
+  // remove labels, determine jump offsets, and point jumps at them
+  ByteCode prepare(const IR& program, std::size_t label_offset) {
+    // jump targets are numbered densely within a parse, so the offset for
+    // each can go in a flat table, which only lasts for this program
+    auto targets = std::vector<std::size_t>{};
+    return prepare(program, label_offset, targets);
+  }
+
+  ByteCode prepare(
+    const IR& program, std::size_t label_offset, std::vector<std::size_t>& targets)
+  {
+    auto rewritten = ByteCode{};
+    rewritten.reserve(program.size());
+    constexpr auto unresolved = std::numeric_limits<std::size_t>::max();
+
+    // offsets of jumps, which hold their target's ID until they're patched
+    auto jumps = std::vector<std::size_t>{};
+
+    for (std::size_t i = 0; i < program.size(); i += 1 + num_labels(program[i].op)) {
+      auto op = program[i].op;
+      if (op == OpCode::Label) {
+        auto id = program[i + 1].label.id();
+        assert(program[i + 1].label.cat() == LabelCat::JumpTarget);
+        if (id >= targets.size())
+          targets.resize(id + 1, unresolved);
+        assert(targets[id] == unresolved);
+        targets[id] = rewritten.size() + label_offset;
+        continue;
+      }
+
+      rewritten.emplace_back(op);
+      for (std::size_t j = 1; j <= num_labels(op); ++j) {
+        auto label = program[i + j].label;
+        if (label.cat() == LabelCat::JumpTarget)
+          jumps.push_back(rewritten.size());
+        rewritten.emplace_back(label);
+      }
     }
 
-    // now we do our mapping back into the offset table
-    for (auto&& [x, id] : local_offsets) {
-      if (auto it = labels.find(id); it != labels.end())
-        rewritten[x] = CodePoint(Label(LabelCat::JumpTarget, it->second));
+    // now point every jump at where its label ended up;
+    // the emitter only ever jumps to labels it has placed
+    for (auto x : jumps) {
+      auto id = rewritten[x].label.id();
+      assert(id < targets.size() and targets[id] != unresolved);
+      rewritten[x] = CodePoint(Label(LabelCat::JumpTarget, targets[id]));
     }
 
     return rewritten;
   }
 
-  void run(ByteCode program) {
-    // make sure we have a "finish" at the end of the program
-    auto end_pos = program.size();
-    auto retval = Environment::get().get_variable("#retval");
-    program.emplace_back(OpCode::Quit);
-    program.emplace_back(retval);
+  std::size_t prepared_size(const IR& program) noexcept {
+    // everything but the labels, which take two code points each
+    auto size = program.size();
+    for (std::size_t i = 0; i < program.size(); i += 1 + num_labels(program[i].op)) {
+      if (program[i].op == OpCode::Label)
+        size -= 2;
+    }
+    return size;
+  }
 
-    // set up the stack frame
-    assert(program[0].op == OpCode::BlockData);
-    Environment::get().push_frame(end_pos, retval, program[1].label.id());
+  void relocate(ByteCode& code, std::size_t offset) noexcept {
+    for (std::size_t i = 0; i < code.size(); i += 1 + num_labels(code[i].op)) {
+      for (std::size_t j = 1; j <= num_labels(code[i].op); ++j) {
+        auto& label = code[i + j].label;
+        if (label.cat() == LabelCat::JumpTarget)
+          label = Label(LabelCat::JumpTarget, label.id() + offset);
+      }
+    }
+  }
+
+  std::size_t enter(ByteCode& program, std::size_t start) {
+    auto& env = Environment::get();
+    auto retval = env.get_variable("#retval");
+
+    // set up the stack frame;
+    // returning from the outermost frame leaves the program
+    assert(program[start].op == OpCode::BlockData);
+    env.push_frame(
+      std::numeric_limits<std::size_t>::max(),
+      retval,
+      program[start + 1].label.id());
 
     // ignore the block data at the start of the program
-    std::size_t offset = 2;  // TODO: make this a global constant
+    return start + 2;  // TODO: make this a global constant
+  }
+
+  std::size_t step(ByteCode& program, std::size_t offset, std::size_t budget) {
+    while (offset < program.size() and budget-- != 0) {
+      auto op = program[offset].op;
+      if (op == OpCode::Prompt and not Environment::get().input().ready())
+        break;
+      offset = get_function(op)(program, offset);
+    }
+    return offset;
+  }
+
+  int exit_status() {
+    auto& env = Environment::get();
+    if (auto code = env.exit_code())
+      return *code;
+    return env.value(env.get_variable("#retval")).to_number();
+  }
+
+  int run(ByteCode& program, std::size_t start) {
+    // blanks and comments compile to no code at all, which does nothing
+    if (start >= program.size())
+      return 0;
+    auto offset = enter(program, start);
 
     // run until we stop
     while (offset < program.size()) {
       auto op = program[offset].op;
       offset = get_function(op)(program, offset);
     }
+
+    return exit_status();
   }
 
 #ifdef KN_HAS_DEBUGGER
@@ -250,6 +275,8 @@ namespace kn::eval {
         return os << "evl ";
       case kn::eval::OpCode::Dump:
         return os << "dmp ";
+      case kn::eval::OpCode::Compile:
+        return os << "cmp ";
 
       case kn::eval::OpCode::NumberOfOps:
         break;
@@ -264,16 +291,20 @@ namespace kn::eval {
         else os << ' ';
         os << std::setw(5) << offset << ": ";
         print_opcode(os, program[offset].op);
-        for (int i = 0; i < get_num_labels(program[offset].op); ++i)
-          print_label(os, program[offset + (std::size_t)i + 1].label) << ' ';
-        offset += (std::size_t)get_num_labels(program[offset].op);
+        for (std::size_t i = 0; i < num_labels(program[offset].op); ++i)
+          print_label(os, program[offset + i + 1].label) << ' ';
+        offset += num_labels(program[offset].op);
         os << '\n';
       }
     }
 
   }
 
-  void debug(ByteCode program) {
+  void debug(ByteCode program, std::size_t start) {
+    // nothing to step through
+    if (start >= program.size())
+      return;
+
     // make sure we have a "finish" at the end of the program
     auto end_pos = program.size();
     auto retval = Environment::get().get_variable("#retval");
@@ -281,10 +312,10 @@ namespace kn::eval {
     program.emplace_back(retval);
 
     // set up the stack frame
-    assert(program[0].op == OpCode::BlockData);
-    Environment::get().push_frame(end_pos, retval, program[1].label.id());
+    assert(program[start].op == OpCode::BlockData);
+    Environment::get().push_frame(end_pos, retval, program[start + 1].label.id());
 
-    std::size_t offset = 2;  // see comment in `run`
+    std::size_t offset = start + 2;  // see comment in `run`
     std::size_t old_size = program.size();
     std::size_t breakpoint = -1;
 
@@ -301,8 +332,9 @@ namespace kn::eval {
 
       std::string inp;
       if (not std::getline(std::cin, inp)) {
+        // return normally, so that buffered output still gets written
         std::cout << "exit.\n";
-        std::exit(0);
+        break;
       }
       // entering nothing goes to the next statement
       if (inp.empty())
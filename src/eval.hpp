@@ -1,6 +1,7 @@
 #ifndef KNIGHT_EVAL_HPP_INCLUDED
 #define KNIGHT_EVAL_HPP_INCLUDED
 
+#include <array>
 #include <cassert>
 #include <cstddef>
 #include <vector>
@@ -117,21 +118,51 @@ namespace kn::eval {
     Eval,
     Dump,
 
+    // the stub for a BLOCK that hasn't been compiled yet
+    Compile,
+
     // total number of elements
     NumberOfOps
   };
 
-  inline constexpr std::size_t max_labels = 5;
-
-  struct Operation {
-    template <typename... Args>
-    Operation(OpCode op, Args... labels)
-      : op(op), labels{ labels... }
-    {}
-
-    OpCode op;
-    Label labels[max_labels];
-  };
+  // how many labels follow each opcode wherever operations are flattened,
+  // which the functions that run them and everything else relies on
+  inline constexpr std::array<std::size_t, static_cast<std::size_t>(OpCode::NumberOfOps)>
+  op_labels = {{
+    0,  // no-op
+    1,  // label
+    1,  // block data
+    2,  // call
+    1,  // return
+    1,  // jump
+    2,  // jump if
+    2,  // jump if not
+    3,  // plus
+    3,  // minus
+    3,  // multiplies
+    3,  // divides
+    3,  // modulus
+    3,  // exponent
+    2,  // negate
+    3,  // less
+    3,  // greater
+    3,  // equals
+    2,  // length
+    4,  // get
+    5,  // substitute
+    2,  // assign
+    1,  // prompt
+    1,  // output
+    1,  // random
+    2,  // shell
+    1,  // quit
+    2,  // eval
+    1,  // dump
+    1,  // compile
+  }};
+  constexpr std::size_t num_labels(OpCode op) noexcept {
+    return op_labels[static_cast<std::size_t>(op)];
+  }
 
   // flattened representation of an operation
   union CodePoint {
@@ -143,16 +174,38 @@ namespace kn::eval {
   };
   using ByteCode = std::vector<CodePoint>;
 
+  // a program on its way to becoming bytecode: operations are flattened
+  // the same way, but labels still mark where jumps go
+  using IR = std::vector<CodePoint>;
+
   // prepare a program for execution
   // `offset` specifies how much to offset new addresses in the resultant code
-  ByteCode prepare(const std::vector<Operation>& program, std::size_t offset = 0);
-
-  // run a prepared program
-  void run(ByteCode program);
+  ByteCode prepare(const IR& program, std::size_t offset = 0);
+  // the same, resolving jumps through `targets`, which maps jump target
+  // IDs to addresses and keeps those defined here for later programs
+  ByteCode prepare(const IR& program, std::size_t offset, std::vector<std::size_t>& targets);
+  // how many code points `prepare` will turn the program into
+  std::size_t prepared_size(const IR& program) noexcept;
+  // move prepared code that was laid out from 0 to start at `offset`
+  void relocate(ByteCode& code, std::size_t offset) noexcept;
+
+  // run the prepared block at `start`, returning its exit status;
+  // code added by EVAL is kept in `program`, so it can be run again
+  int run(ByteCode& program, std::size_t start = 0);
+
+  // the pieces of `run`, for running a program a slice at a time:
+  // `enter` sets up the block at `start` and returns the first offset;
+  // `step` runs up to `budget` instructions, stopping early at a PROMPT
+  // with no input ready, and returns the offset to resume from, which is
+  // past the end of `program` once it has finished;
+  // `exit_status` then gives the result
+  std::size_t enter(ByteCode& program, std::size_t start = 0);
+  std::size_t step(ByteCode& program, std::size_t offset, std::size_t budget);
+  int exit_status();
 
 #ifdef KN_HAS_DEBUGGER
   // step through a prepared program
-  void debug(ByteCode program);
+  void debug(ByteCode program, std::size_t start = 0);
 #endif
 
 }
@@ -1,19 +1,24 @@
 #include "funcs.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <charconv>
 #include <cmath>
 #include <cstdlib>
 #include <functional>
-#include <iostream>
-#include <random>
-#include <unordered_map>
+#include <future>
+#include <optional>
+#include <limits>
+#include <string_view>
 #include <vector>
 
+#include "deferred.hpp"
+#include "direct.hpp"
 #include "env.hpp"
 #include "error.hpp"
-#include "ir.hpp"
 #include "lexer.hpp"
 #include "parser.hpp"
+#include "scan.hpp"
 #include "value.hpp"
 
 using namespace kn::eval;
@@ -54,6 +59,22 @@ namespace {
     return offset + 4;
   }
 
+  // like binary_math_op, but a zero divisor is an error rather than a
+  // signal, so that whatever's still buffered gets written out
+  template <typename F>
+  std::size_t binary_divide_op(ByteCode& bytecode, std::size_t offset, F f) {
+    auto lhs = get_value(bytecode[offset + 2]);
+    if (lhs.is_number()) {
+      auto x = lhs.to_number();
+      auto y = get_value(bytecode[offset + 3]).to_number();
+      if (y.value == 0)
+        throw kn::Error("error: division by zero");
+      set_result(bytecode, offset, f(x, y));
+    }
+
+    return offset + 4;
+  }
+
   template <typename F>
   std::size_t binary_compare_op(ByteCode& bytecode, std::size_t offset, F f) {
     auto lhs = get_value(bytecode[offset + 2]);
@@ -75,12 +96,104 @@ namespace {
     return offset + 4;
   }
 
-  std::unordered_map<std::string, std::size_t> evals;
+  // EVAL strings are often just a variable, a number, or a single
+  // arithmetic or comparison on those (think `E + "x" i`), so handle
+  // those directly rather than compiling more code for each one;
+  // anything else gives nullopt and goes through the full pipeline
+  constexpr bool is_digit(char c) noexcept { return '0' <= c and c <= '9'; }
+  constexpr bool is_head(char c) noexcept { return ('a' <= c and c <= 'z') or c == '_'; }
+
+  // the next number, identifier or symbol in `code`, split up the same
+  // way the lexer does it, or empty at the end
+  std::string_view next_word(std::string_view& code) noexcept {
+    auto end = code.data() + code.size();
+    auto first = kn::lexer::skip_blanks(code.data(), end);
+    auto last = first == end ? end
+      : is_digit(*first) ? kn::lexer::skip_digits(first + 1, end)
+      : is_head(*first) ? kn::lexer::skip_ident(first + 1, end)
+      : first + 1;
+
+    code = std::string_view(last, static_cast<std::size_t>(end - last));
+    return std::string_view(first, static_cast<std::size_t>(last - first));
+  }
+
+  std::optional<Value> quick_atom(std::string_view word) {
+    if (word.empty())
+      return std::nullopt;
+    if (is_digit(word.front())) {
+      auto n = Number::type{};
+      auto [end, ec] = std::from_chars(word.data(), word.data() + word.size(), n);
+      if (ec != std::errc() or end != word.data() + word.size())
+        return std::nullopt;
+      return Value(n);
+    }
+    if (is_head(word.front())) {
+      auto& env = Environment::get();
+      return env.value(env.get_variable(word));
+    }
+    return std::nullopt;
+  }
+
+  std::optional<Value> quick_eval(std::string_view code) {
+    auto word = next_word(code);
+    if (word.size() != 1 or is_digit(word.front()) or is_head(word.front())) {
+      // a lone variable or number
+      if (not next_word(code).empty())
+        return std::nullopt;
+      return quick_atom(word);
+    }
+
+    auto op = word.front();
+    if (std::string_view("+-*/%<>?").find(op) == std::string_view::npos)
+      return std::nullopt;
+    auto lhs = quick_atom(next_word(code));
+    if (not lhs)
+      return std::nullopt;
+    auto rhs = quick_atom(next_word(code));
+    if (not rhs or not next_word(code).empty())
+      return std::nullopt;
+
+    if (op == '?')
+      return Value(*lhs == *rhs);
+    if (lhs->is_number()) {
+      auto x = lhs->to_number();
+      auto y = rhs->to_number();
+      switch (op) {
+      case '+': return Value(x + y);
+      case '-': return Value(x - y);
+      case '*': return Value(x * y);
+      case '<': return Value(x < y);
+      case '>': return Value(x > y);
+      }
+      // leave dividing by zero to raise its error normally
+      if (y.value == 0)
+        return std::nullopt;
+      return Value(op == '/' ? x / y : x % y);
+    }
+    if (lhs->is_string()) {
+      auto x = lhs->to_string();
+      auto y = rhs->to_string();
+      switch (op) {
+      case '+': return Value(x + y);
+      case '<': return Value(x.as_str_view() < y.as_str_view());
+      case '>': return Value(x.as_str_view() > y.as_str_view());
+      }
+    }
+    return std::nullopt;
+  }
 
 }
 
 namespace kn::funcs {
 
+  namespace {
+    bool async_shell = false;
+  }
+
+  void set_async_shell(bool enabled) noexcept {
+    async_shell = enabled;
+  }
+
   // control flow
 
   std::size_t no_op(ByteCode&, std::size_t offset) {
@@ -192,12 +305,12 @@ namespace kn::funcs {
 
   std::size_t divides(ByteCode& bytecode, std::size_t offset) {
     assert(bytecode[offset].op == OpCode::Divides);
-    return binary_math_op(bytecode, offset, std::divides{});
+    return binary_divide_op(bytecode, offset, std::divides{});
   }
 
   std::size_t modulus(ByteCode& bytecode, std::size_t offset) {
     assert(bytecode[offset].op == OpCode::Modulus);
-    return binary_math_op(bytecode, offset, std::modulus{});
+    return binary_divide_op(bytecode, offset, std::modulus{});
   }
 
   std::size_t exponent(ByteCode& bytecode, std::size_t offset) {
@@ -269,43 +382,61 @@ namespace kn::funcs {
 
   std::size_t assign(ByteCode& bytecode, std::size_t offset) {
     assert(bytecode[offset].op == OpCode::Assign);
-    set_result(bytecode, offset, get_value(bytecode[offset + 2]));
+    // pass pending results along rather than waiting for them yet
+    if (auto from = bytecode[offset + 2].label; from.cat() == LabelCat::Variable
+        or from.cat() == LabelCat::Temporary)
+      set_result(bytecode, offset, Value(Environment::get().peek(from)));
+    else
+      set_result(bytecode, offset, get_value(bytecode[offset + 2]));
     return offset + 3;
   }
 
   std::size_t prompt(ByteCode& bytecode, std::size_t offset) {
     assert(bytecode[offset].op == OpCode::Prompt);
-    auto line = std::string{};
-    std::getline(std::cin, line);
-    set_result(bytecode, offset, String(std::move(line)));
+    auto& env = Environment::get();
+    env.flush_output(Environment::Flush::BeforeInput);
+    auto line = env.input().read_string();
+    set_result(bytecode, offset, line ? std::move(*line) : String(std::string_view{}));
     return offset + 2;
   }
 
   std::size_t output(ByteCode& bytecode, std::size_t offset) {
     assert(bytecode[offset].op == OpCode::Output);
-    get_value(bytecode[offset + 1]).to_string().output(std::cout);
+    auto& env = Environment::get();
+    get_value(bytecode[offset + 1]).to_string().output(env.output());
+    env.flush_output(Environment::Flush::EveryLine);
     return offset + 2;
   }
 
   std::size_t random(ByteCode& bytecode, std::size_t offset) {
     assert(bytecode[offset].op == OpCode::Random);
-    thread_local auto generator = std::mt19937(std::random_device{}());
-    thread_local auto dist = std::uniform_int_distribution(
-      Number::type{}, std::numeric_limits<Number::type>::max());
-    set_result(bytecode, offset, dist(generator));
+    // the top bits are the best, and 31 of them covers every positive int
+    static_assert(std::numeric_limits<Number::type>::max() == 0x7fffffff);
+    auto bits = Environment::get().random().next() >> 33;
+    set_result(bytecode, offset, static_cast<Number::type>(bits));
     return offset + 2;
   }
 
   std::size_t shell(ByteCode& bytecode, std::size_t offset) {
     assert(bytecode[offset].op == OpCode::Shell);
     auto str = get_value(bytecode[offset + 2]).to_string().as_str();
-    set_result(bytecode, offset, String(open_shell(str)));
+    Environment::get().flush_output(Environment::Flush::BeforeInput);
+    if (async_shell) {
+      // let it run while we carry on, until something needs the output
+      auto result = std::async(std::launch::async,
+        [command = std::move(str)] { return open_shell(command); });
+      set_result(bytecode, offset, Value::from_future(std::move(result)));
+    } else {
+      set_result(bytecode, offset, open_shell(str));
+    }
     return offset + 3;
   }
 
   std::size_t quit(ByteCode& bytecode, std::size_t offset) {
     assert(bytecode[offset].op == OpCode::Quit);
-    std::exit(get_value(bytecode[offset + 1]).to_number());
+    Environment::get().set_exit_code(get_value(bytecode[offset + 1]).to_number());
+    // jumping past the end of the program stops execution
+    return bytecode.size();
   }
 
   // TODO: rewrite eval?
@@ -321,48 +452,77 @@ namespace kn::funcs {
       // just assign NULL to the output and off we go
       set_result(bytecode, offset, Null{});
       return next_statement;
-    } else if (auto it = evals.find(input); it != evals.end()) {
-      Environment::get().push_frame(
-        offset + 3,
-        bytecode[offset + 1].label,
-        bytecode[it->second - 1].label.id());
-      return it->second;
+    } else if (auto value = quick_eval(input)) {
+      set_result(bytecode, offset, std::move(*value));
+      return next_statement;
+    }
+
+    auto& env = Environment::get();
+    if (auto cached = env.evals().find(input)) {
+      env.push_frame(
+        next_statement, result, bytecode[cached->start + 1].label.id());
+      return cached->start + 2;  // see `eval::run`
     }
 
-    auto tokens = kn::lexer::tokenise(input);
-    if (tokens.empty()) {
+    // code that's only going to be EVALed is compiled directly, since it
+    // wouldn't run for long enough to make optimising it worthwhile
+    auto compiled = kn::parser::compile(input);
+    if (compiled.empty()) {
       // if they just gave a string full of blanks or something
       set_result(bytecode, offset, Null{});
       return next_statement;
     }
 
-    auto parsed = kn::parser::parse(tokens);
-    auto program = kn::ir::optimise(parsed);
-
-    // store offsets and prepare new bytecode
-    auto new_offset = bytecode.size() + 2;  // see `eval::run`
-    auto new_bytecode = kn::eval::prepare(program, bytecode.size());
+    // find room for the new code, maybe where some old code used to be;
+    // anything still on the stack (including us) has to stay put
+    auto& new_bytecode = compiled.code;
+    auto size = new_bytecode.size();
+    auto start = env.evals().allocate(size, bytecode.size(),
+      [&](std::size_t first, std::size_t last) {
+        return (offset >= first and offset < last) or env.is_running(first, last);
+      });
+    kn::eval::relocate(new_bytecode, start);
 
     // get block data and construct new stack frame
     assert(new_bytecode[0].op == OpCode::BlockData);
-    Environment::get().push_frame(
-      next_statement, result, new_bytecode[1].label.id());
+    env.push_frame(next_statement, result, new_bytecode[1].label.id());
 
     // add the bytecode to the current execution set
-    bytecode.insert(bytecode.end(), new_bytecode.begin(), new_bytecode.end());
+    if (start == bytecode.size())
+      bytecode.insert(bytecode.end(), new_bytecode.begin(), new_bytecode.end());
+    else
+      std::copy(new_bytecode.begin(), new_bytecode.end(),
+        bytecode.begin() + static_cast<std::ptrdiff_t>(start));
 
-    // cache the string so we don't need to parse this one again
-    evals.emplace(std::move(input), new_offset);
+    // cache the string so we don't need to parse this one again;
+    // any blocks it defines could be stored away anywhere, so keep those
+    env.evals().insert(std::move(input), { start, size, compiled.blocks > 0 });
 
     // return the start of the newly evaluated bytecode
-    return new_offset;
+    return start + 2;
   }
 
   std::size_t dump(ByteCode& bytecode, std::size_t offset) {
     assert(bytecode[offset].op == OpCode::Dump);
-    std::cout << get_value(bytecode[offset + 1]);
+    auto& env = Environment::get();
+    env.output() << get_value(bytecode[offset + 1]);
+    env.flush_output(Environment::Flush::EveryLine);
     return offset + 2;
   }
 
+  std::size_t compile(ByteCode& bytecode, std::size_t offset) {
+    assert(bytecode[offset].op == OpCode::Compile);
+    auto& env = Environment::get();
+    assert(env.deferred());
+    auto dest = env.deferred()->compile(bytecode, bytecode[offset + 1].label.id());
+
+    // the frame was made for the stub, which didn't know how many
+    // temporaries the block would need
+    auto num_temps = bytecode[offset - 1].label.id();
+    auto [retaddr, result] = env.pop_frame();
+    env.push_frame(retaddr, result, num_temps);
+    return dest;
+  }
+
 }
 
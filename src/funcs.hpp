@@ -4,10 +4,21 @@
 #include <cstddef>
 #include <string>
 #include "eval.hpp"
+#include "value.hpp"
 
 namespace kn::funcs {
 
-  std::string open_shell(const std::string& command);
+  // a long-lived shell that SHELL commands can be sent to
+  class ShellSession;
+
+  // run `command`, returning everything it wrote to stdout
+  kn::eval::String open_shell(const std::string& command);
+  // whether SHELL reuses one long-lived shell per thread where it safely
+  // can, rather than starting a new one for every command
+  void set_persistent_shell(bool enabled) noexcept;
+  // whether SHELL carries on without waiting for the command, which is
+  // only waited for once something needs its output
+  void set_async_shell(bool enabled) noexcept;
 
   // control flow
   std::size_t no_op(kn::eval::ByteCode& bytecode, std::size_t offset);
@@ -47,6 +58,9 @@ namespace kn::funcs {
   std::size_t eval(kn::eval::ByteCode& bytecode, std::size_t offset);
   std::size_t dump(kn::eval::ByteCode& bytecode, std::size_t offset);
 
+  // lazily compiled code
+  std::size_t compile(kn::eval::ByteCode& bytecode, std::size_t offset);
+
 }
 
 #endif // KNIGHT_FUNCS_HPP_INCLUDED
@@ -0,0 +1,260 @@
+#include "image.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string_view>
+#include <type_traits>
+
+#include "error.hpp"
+#include "intern.hpp"
+#include "mapping.hpp"
+#include "value.hpp"
+
+using namespace kn::eval;
+
+namespace {
+
+  constexpr std::string_view magic = "knimage2";
+  // written natively, so a mismatch means a different byte order
+  constexpr std::uint64_t byte_order = 0x0102030405060708;
+
+  static_assert(std::is_trivially_copyable_v<CodePoint>);
+
+  enum class Tag : unsigned char {
+    Undefined, Null, Boolean, Number, String, Block
+  };
+
+  class Writer {
+  public:
+    void raw(const void* p, std::size_t n) {
+      data.append(static_cast<const char*>(p), n);
+    }
+    void u64(std::uint64_t x) { raw(&x, sizeof x); }
+    void tag(Tag t) { data.push_back(static_cast<char>(t)); }
+    void str(std::string_view s) { u64(s.size()); raw(s.data(), s.size()); }
+
+    void value(const Value& v) {
+      if (v.is_null()) {
+        tag(Tag::Null);
+      } else if (v.is_bool()) {
+        tag(Tag::Boolean);
+        u64(v.to_bool() ? 1 : 0);
+      } else if (v.is_number()) {
+        tag(Tag::Number);
+        u64(static_cast<std::uint64_t>(static_cast<std::int64_t>(v.to_number().value)));
+      } else if (v.is_string() or v.is_pending()) {
+        tag(Tag::String);
+        str(v.to_string().as_str_view());
+      } else {
+        tag(Tag::Block);
+        u64(v.to_block().address);
+      }
+    }
+
+    std::string data;
+  };
+
+  class Reader {
+  public:
+    explicit Reader(std::string_view data) : data(data) {}
+
+    std::string_view raw(std::size_t n) {
+      if (n > data.size())
+        throw kn::Error("error: truncated image");
+      auto result = data.substr(0, n);
+      data.remove_prefix(n);
+      return result;
+    }
+    std::uint64_t u64() {
+      std::uint64_t x;
+      std::memcpy(&x, raw(sizeof x).data(), sizeof x);
+      return x;
+    }
+    std::size_t size() { return static_cast<std::size_t>(u64()); }
+    Tag tag() { return static_cast<Tag>(raw(1)[0]); }
+    std::string_view str() { return raw(size()); }
+
+    Value value(Tag t) {
+      switch (t) {
+      case Tag::Null:
+        return Null{};
+      case Tag::Boolean:
+        return u64() != 0;
+      case Tag::Number:
+        return static_cast<Number::type>(static_cast<std::int64_t>(u64()));
+      case Tag::String:
+        return String(str());
+      case Tag::Block:
+        return Block{ size() };
+      case Tag::Undefined:
+        break;
+      }
+      throw kn::Error("error: corrupt image");
+    }
+    Value value() { return value(tag()); }
+
+    bool done() const noexcept { return data.empty(); }
+    std::size_t remaining() const noexcept { return data.size(); }
+
+  private:
+    std::string_view data;
+  };
+
+  // make sure the code only refers to things the image has, so that a
+  // corrupt image is reported rather than running off into the weeds
+  void check(const Image& image, const std::string& path) {
+    const auto& code = image.code;
+    const auto& env = image.env;
+    const auto corrupt = [&path]() {
+      return kn::Error("error: corrupt image " + path);
+    };
+    const auto check_value = [&](const Value& v) {
+      if (v.is_block() and v.to_block().address >= code.size())
+        throw corrupt();
+    };
+
+    for (std::size_t i = 0; i < code.size(); i += 1 + num_labels(code[i].op)) {
+      auto op = static_cast<std::size_t>(code[i].op);
+      // nothing is left to be compiled lazily once an image is saved
+      if (op >= static_cast<std::size_t>(OpCode::Compile))
+        throw corrupt();
+      if (code.size() - i <= num_labels(code[i].op))
+        throw corrupt();
+
+      for (std::size_t j = 1; j <= num_labels(code[i].op); ++j) {
+        auto label = code[i + j].label;
+        switch (label.cat()) {
+        case LabelCat::Constant:
+        case LabelCat::Temporary:
+          break;
+        case LabelCat::Variable:
+          if (label.id() >= env.values.size())
+            throw corrupt();
+          break;
+        case LabelCat::JumpTarget:
+          if (label.id() >= code.size())
+            throw corrupt();
+          break;
+        case LabelCat::Literal:
+          if (label.id() >= env.literals.size())
+            throw corrupt();
+          break;
+        default:
+          throw corrupt();
+        }
+      }
+    }
+
+    for (const auto& value : env.values) {
+      if (value)
+        check_value(*value);
+    }
+    for (const auto& lit : env.literals)
+      check_value(lit);
+    env.evals.for_each([&](const std::string&, const EvalCache::Entry& entry) {
+      if (entry.start >= code.size() or code[entry.start].op != OpCode::BlockData)
+        throw corrupt();
+    });
+  }
+
+}
+
+namespace kn::eval {
+
+  void save_image(const std::string& path, const Image& image) {
+    auto w = Writer{};
+    w.raw(magic.data(), magic.size());
+    w.u64(byte_order);
+    w.u64(sizeof(CodePoint));
+
+    w.u64(image.code.size());
+    w.raw(image.code.data(), image.code.size() * sizeof(CodePoint));
+
+    const auto& env = image.env;
+    w.u64(env.names.size());
+    for (std::size_t i = 0; i < env.names.size(); ++i) {
+      w.str(env.names[i]);
+      if (env.values[i])
+        w.value(*env.values[i]);
+      else
+        w.tag(Tag::Undefined);
+    }
+
+    w.u64(env.literals.size());
+    for (const auto& lit : env.literals)
+      w.value(lit);
+
+    // free space left behind by evicted code isn't kept
+    w.u64(env.evals.size());
+    env.evals.for_each([&](const std::string& code, const EvalCache::Entry& entry) {
+      w.str(code);
+      w.u64(entry.start);
+      w.u64(entry.size);
+      w.u64(entry.pinned);
+    });
+
+    auto f = std::ofstream(path, std::ios::binary);
+    f.write(w.data.data(), static_cast<std::streamsize>(w.data.size()));
+    if (not f)
+      throw kn::Error("error: unable to write image " + path);
+  }
+
+  Image load_image(const std::string& path) {
+    auto file = kn::MappedFile(path);
+    auto r = Reader(file.data());
+
+    if (r.raw(magic.size()) != magic or r.u64() != byte_order
+        or r.u64() != sizeof(CodePoint))
+      throw kn::Error("error: " + path + " is not a compatible image");
+
+    auto image = Image{};
+
+    // the code is by far the biggest part, so copy it across in one go
+    auto num_code = r.size();
+    if (num_code > r.remaining() / sizeof(CodePoint))
+      throw kn::Error("error: truncated image");
+    auto code = r.raw(num_code * sizeof(CodePoint));
+    image.code.assign(num_code, CodePoint(Label{}));
+    std::memcpy(image.code.data(), code.data(), code.size());
+
+    auto& env = image.env;
+    auto num_vars = r.size();
+    for (std::size_t i = 0; i < num_vars; ++i) {
+      auto& name = env.names.emplace_back(r.str());
+      env.variable_ids.intern(name, kn::intern_hash(name), i,
+        [&env](std::size_t id) { return std::string_view(env.names[id]); });
+      if (auto t = r.tag(); t == Tag::Undefined)
+        env.values.emplace_back();
+      else
+        env.values.emplace_back(r.value(t));
+    }
+
+    auto num_literals = r.size();
+    for (std::size_t i = 0; i < num_literals; ++i) {
+      const auto& lit = env.literals.emplace_back(r.value());
+      if (auto s = lit.as_string()) {
+        env.literal_ids.intern(s->as_str_view(), kn::intern_hash(s->as_str_view()), i,
+          [&env](std::size_t id) { return env.literals[id].as_string()->as_str_view(); });
+      }
+    }
+
+    auto num_evals = r.size();
+    for (std::size_t i = 0; i < num_evals; ++i) {
+      auto key = std::string(r.str());
+      auto entry = EvalCache::Entry{};
+      entry.start = r.size();
+      entry.size = r.size();
+      entry.pinned = r.size() != 0;
+      if (entry.start + entry.size > image.code.size())
+        throw kn::Error("error: corrupt image " + path);
+      env.evals.insert(std::move(key), entry);
+    }
+
+    if (not r.done())
+      throw kn::Error("error: trailing data in image " + path);
+    check(image, path);
+    return image;
+  }
+
+}
@@ -0,0 +1,23 @@
+#ifndef KNIGHT_IMAGE_HPP_INCLUDED
+#define KNIGHT_IMAGE_HPP_INCLUDED
+
+#include <string>
+#include "env.hpp"
+#include "eval.hpp"
+
+namespace kn::eval {
+
+  // a snapshot of the environment along with all the code it refers to,
+  // including anything appended by EVAL
+  struct Image {
+    Environment::Snapshot env;
+    ByteCode code;
+  };
+
+  // images are only portable between builds on the same architecture
+  void save_image(const std::string& path, const Image& image);
+  Image load_image(const std::string& path);
+
+}
+
+#endif  // KNIGHT_IMAGE_HPP_INCLUDED
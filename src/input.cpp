@@ -0,0 +1,132 @@
+#include "input.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+  constexpr std::size_t block_size = 64 * 1024;
+
+  // unlike fread, this returns as soon as anything is available,
+  // so interactive input isn't held up waiting for a full block
+  std::size_t read_some(int fd, char* buffer, std::size_t size) {
+#ifdef _WIN32
+    auto n = ::_read(fd, buffer, static_cast<unsigned>(size));
+#else
+    auto n = ::read(fd, buffer, size);
+#endif
+    return n > 0 ? static_cast<std::size_t>(n) : 0;
+  }
+
+}
+
+namespace kn::eval {
+
+  Input::Input(int fd)
+    : fd(fd)
+    , waiting(false)
+    , chunk()
+    , used(0)
+    , pending()
+  {}
+
+  Input::Input(std::string_view data) noexcept
+    : fd(-1)
+    , waiting(false)
+    , chunk()
+    , used(0)
+    , pending(data)
+  {}
+
+  Input::Input(String data) noexcept
+    : fd(-1)
+    , waiting(false)
+    , chunk(std::move(data))
+    , used(chunk->size())
+    , pending(chunk->as_str_view())
+  {}
+
+  Input::Input() noexcept
+    : fd(-1)
+    , waiting(true)
+    , chunk()
+    , used(0)
+    , pending()
+  {}
+
+  void Input::feed(std::string_view data) {
+    std::memcpy(reserve(data.size()), data.data(), data.size());
+    commit(data.size());
+  }
+
+  std::optional<std::string_view> Input::read_line() {
+    std::size_t searched = 0;
+    for (;;) {
+      if (auto nl = pending.find('\n', searched); nl != std::string_view::npos) {
+        auto line = pending.substr(0, nl);
+        pending.remove_prefix(nl + 1);
+        return line;
+      }
+      searched = pending.size();
+      if (not refill())
+        break;
+    }
+
+    if (pending.empty())
+      return std::nullopt;
+    return std::exchange(pending, std::string_view{});
+  }
+
+  std::optional<String> Input::read_string() {
+    auto line = read_line();
+    if (not line)
+      return std::nullopt;
+    if (chunk and not line->empty()) {
+      auto whole = chunk->as_str_view();
+      if (line->data() >= whole.data() and line->data() < whole.data() + whole.size()) {
+        auto pos = static_cast<std::size_t>(line->data() - whole.data());
+        return chunk->substr(pos, line->size());
+      }
+    }
+    return String(*line);
+  }
+
+  bool Input::refill() {
+    if (fd < 0)
+      return false;
+
+    auto space = reserve(block_size / 4);
+    auto read = read_some(fd, space, chunk->size() - used);
+    commit(read);
+    return read != 0;
+  }
+
+  char* Input::reserve(std::size_t size) {
+    if (not chunk or used + size > chunk->size()) {
+      // lines handed out may still be looking at the old chunk, so
+      // start another, taking along whatever hasn't been read yet
+      auto kept = pending.size();
+      auto fresh = String::uninitialised(std::max(block_size, 2 * (kept + size)));
+      if (kept != 0)
+        std::memcpy(fresh.buffer(), pending.data(), kept);
+      chunk = std::move(fresh);
+      used = kept;
+      pending = std::string_view(chunk->buffer(), kept);
+    }
+    return chunk->buffer() + used;
+  }
+
+  void Input::commit(std::size_t size) noexcept {
+    auto start = chunk->buffer() + used - pending.size();
+    used += size;
+    pending = std::string_view(start, pending.size() + size);
+  }
+
+}
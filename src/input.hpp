@@ -0,0 +1,57 @@
+#ifndef KNIGHT_INPUT_HPP_INCLUDED
+#define KNIGHT_INPUT_HPP_INCLUDED
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+#include "value.hpp"
+
+namespace kn::eval {
+
+  // line-oriented input for PROMPT, read from a file descriptor in large blocks
+  class Input {
+  public:
+    // read from the file descriptor `fd`, which remains owned by the caller
+    explicit Input(int fd);
+    // serve lines straight out of `data` without copying
+    explicit Input(std::string_view data) noexcept;
+    // the same, and lines read as strings share `data` too
+    explicit Input(String data) noexcept;
+    // serve lines given to `feed`, until `close` is called
+    Input() noexcept;
+
+    void feed(std::string_view data);
+    void close() noexcept { waiting = false; }
+
+    // whether `read_line` can go ahead without waiting to be fed
+    bool ready() const noexcept {
+      return not waiting or pending.find('\n') != std::string_view::npos;
+    }
+
+    // the next line without its '\n', or nullopt at the end of input;
+    // the view is only valid until the next call
+    std::optional<std::string_view> read_line();
+    // the same, as a string sharing the block it was read into
+    std::optional<String> read_string();
+
+  private:
+    // read another block from the file, returning false at EOF
+    bool refill();
+    // make room for at least `size` more bytes after the pending data,
+    // returning where they go; `commit` then adds them to the pending data
+    char* reserve(std::size_t size);
+    void commit(std::size_t size) noexcept;
+
+    int fd;
+    bool waiting;
+    // lines that have been handed out as strings keep referring to this,
+    // so it's only ever appended to, and replaced once it fills up
+    std::optional<String> chunk;
+    std::size_t used;
+    std::string_view pending;
+  };
+
+}
+
+#endif  // KNIGHT_INPUT_HPP_INCLUDED
@@ -0,0 +1,78 @@
+#ifndef KNIGHT_INTERN_HPP_INCLUDED
+#define KNIGHT_INTERN_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace kn {
+
+  // the hash strings are interned by; the lexer works it out for each
+  // identifier and string literal, so it only has to be done once
+  constexpr std::size_t intern_hash(std::string_view s) noexcept {
+    // FNV-1a, then mixed so the low bits are usable as a table index
+    auto h = std::uint64_t{ 0xcbf29ce484222325 };
+    for (auto c : s)
+      h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+    h ^= h >> 32;
+    return static_cast<std::size_t>(h);
+  }
+
+  // maps strings to ids with open addressing, for names and literals;
+  // the strings themselves are kept by the caller, who hands over a
+  // way to get the one for an id, so a lookup never has to allocate
+  class Interner {
+  public:
+    // the id `key` already has, or otherwise `new_id`, which from now on
+    // `key_of(new_id)` has to give `key` for
+    template <typename KeyOf>
+    std::size_t intern(std::string_view key, std::size_t hash, std::size_t new_id, KeyOf key_of) {
+      if (2 * (count + 1) > slots.size())
+        grow();
+
+      auto mask = slots.size() - 1;
+      for (auto i = hash & mask;; i = (i + 1) & mask) {
+        auto& slot = slots[i];
+        if (slot.id == empty) {
+          slot = { hash, new_id };
+          ++count;
+          return new_id;
+        }
+        if (slot.hash == hash and key_of(slot.id) == key)
+          return slot.id;
+      }
+    }
+
+    std::size_t size() const noexcept { return count; }
+
+  private:
+    static constexpr auto empty = static_cast<std::size_t>(-1);
+
+    struct Slot {
+      std::size_t hash = 0;
+      std::size_t id = empty;
+    };
+
+    // double the table, which stays at most half full
+    void grow() {
+      auto old = std::vector<Slot>(slots.empty() ? 16 : 2 * slots.size());
+      old.swap(slots);
+      auto mask = slots.size() - 1;
+      for (const auto& slot : old) {
+        if (slot.id == empty)
+          continue;
+        auto i = slot.hash & mask;
+        while (slots[i].id != empty)
+          i = (i + 1) & mask;
+        slots[i] = slot;
+      }
+    }
+
+    std::vector<Slot> slots;
+    std::size_t count = 0;
+  };
+
+}
+
+#endif  // KNIGHT_INTERN_HPP_INCLUDED
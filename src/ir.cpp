@@ -2,17 +2,16 @@
 
 namespace kn::ir {
 
-  std::vector<eval::Operation> optimise(const parser::Block& block) {
+  void optimise(const parser::Block& block, eval::IR& ir) {
     // TODO: actually optimise
-    return { block.begin(), block.end() };
+    for (const auto& node : block)
+      ir.insert(ir.end(), node.code(), node.code() + node.size());
   }
 
-  std::vector<eval::Operation> optimise(const std::vector<parser::Block> &blocks) {
-    auto result = std::vector<eval::Operation>{};
-    for (const auto& blk : blocks) {
-      auto opt = optimise(blk);
-      result.insert(result.end(), opt.begin(), opt.end());
-    }
+  eval::IR optimise(const parser::Program& program) {
+    auto result = eval::IR{};
+    for (const auto& blk : program.blocks)
+      optimise(blk, result);
     return result;
   }
 
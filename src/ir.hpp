@@ -6,8 +6,9 @@
 
 namespace kn::ir {
 
-  std::vector<eval::Operation> optimise(const parser::Block& block);
-  std::vector<eval::Operation> optimise(const std::vector<parser::Block>& blocks);
+  // append the flattened instructions of `block` to `ir`
+  void optimise(const parser::Block& block, eval::IR& ir);
+  eval::IR optimise(const parser::Program& program);
 
 }
 
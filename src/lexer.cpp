@@ -1,13 +1,18 @@
 #include "lexer.hpp"
 
-#include <algorithm>
 #include <cassert>
 #include <charconv>
+#include <deque>
+#include <exception>
+#include <future>
 #include <iterator>
-#include <iostream>
+#include <thread>
+#include <vector>
 
-#include "sourcepos.hpp"
 #include "error.hpp"
+#include "intern.hpp"
+#include "scan.hpp"
+#include "sourcepos.hpp"
 
 namespace {
 
@@ -16,112 +21,210 @@ namespace {
   constexpr bool is_numeric(char c) { return '0' <= c and c <= '9'; }
 
   constexpr bool is_head(char c) { return ('a' <= c and c <= 'z') or c == '_'; }
-  constexpr bool is_ident(char c) { return is_head(c) or is_numeric(c); }
 
   constexpr bool is_func_head(char c) { return 'A' <= c and c <= 'Z'; }
-  constexpr bool is_func_cont(char c) { return is_func_head(c) or c == '_'; }
+
+  // sources at least this big are lexed in chunks on several threads
+  constexpr std::size_t parallel_threshold = 4 << 20;
+  constexpr std::size_t chunk_size = 1 << 20;
 
   // types and helpers for parsing
 
-  using iter = kn::SourceIterator;
+  using iter = const char*;
   struct ParseResult {
     kn::lexer::Token token;
-    kn::SourceIterator next_iter;
+    iter next_iter;
   };
 
-  // Not quite an adjacent find;
-  // we get the last contiguous element such that pred still holds.
-  // We assume pred holds for *first, i.e. that first != last.
-  template <typename Pred>
-  iter find_last_contiguous(iter first, iter last, Pred pred) {
-    iter next = std::next(first);
-    for (; next != last; ++next, ++first)
-      if (not pred(*next))
-        return first;
-    return first;
+  std::size_t offset_of(std::string_view source, iter it) {
+    return static_cast<std::size_t>(it - source.data());
+  }
+
+  std::size_t distance(iter first, iter last) {
+    return static_cast<std::size_t>(last - first);
+  }
+
+  // only worked out once something has gone wrong
+  std::pair<kn::SourcePosition, kn::SourcePosition>
+  range_of(std::string_view source, iter first, iter last) {
+    auto lines = kn::LineIndex(source);
+    return { lines.at(offset_of(source, first)), lines.at(offset_of(source, last) - 1) };
   }
 
   // parse functions
 
-  ParseResult parse_string_literal(iter first, iter end) {
+  ParseResult parse_string_literal(std::string_view source, iter first, iter end) {
     assert(*first == '\'' or *first == '"');
 
     // find next matching quote char
-    if (auto last = std::find(std::next(first), end, *first); last != end) {
+    if (auto last = kn::lexer::find_char(std::next(first), end, *first); last != end) {
       auto next_iter = std::next(last);
       // contents of literal is within the quotes
-      auto lit = std::string_view(
-        first.base() + 1,
-        static_cast<std::size_t>(next_iter.base() - first.base() - 2));
+      auto lit = std::string_view(first + 1, distance(first, last) - 1);
 
       // position of literal includes the quotes
       return ParseResult{
-        { kn::lexer::StringLiteral{ lit }, first.pos(), last.pos() },
+        { kn::lexer::StringLiteral{ lit, kn::intern_hash(lit) }, offset_of(source, first), distance(first, next_iter) },
         next_iter
       };
     } else {
-      throw kn::Error(first.pos(), "error: unterminated string literal");
+      throw kn::Error(range_of(source, first, first + 1).first,
+        "error: unterminated string literal");
     }
   }
 
-  ParseResult parse_numeric_literal(iter first, iter end) {
+  ParseResult parse_numeric_literal(std::string_view source, iter first, iter end) {
     assert(is_numeric(*first));
 
-    auto last = find_last_contiguous(first, end, is_numeric);
-    auto next_iter = std::next(last);
+    auto next_iter = kn::lexer::skip_digits(first, end);
 
     int result = 0;
-    auto [_, ec] = std::from_chars(first.base(), next_iter.base(), result);
+    auto [_, ec] = std::from_chars(first, next_iter, result);
     if (ec != std::errc()) {
       if (ec == std::errc::result_out_of_range)
-        throw kn::Error(first.pos(), last.pos(), "error: number out of range");
+        throw kn::Error(range_of(source, first, next_iter), "error: number out of range");
       else
-        throw kn::Error(first.pos(), last.pos(), "error: couldn't parse literal");
+        throw kn::Error(range_of(source, first, next_iter), "error: couldn't parse literal");
     }
 
     return ParseResult{
-      { kn::lexer::NumericLiteral{ result }, first.pos(), last.pos() },
+      { kn::lexer::NumericLiteral{ result }, offset_of(source, first), distance(first, next_iter) },
       next_iter
     };
   }
 
-  ParseResult parse_identifier(iter first, iter end) {
+  ParseResult parse_identifier(std::string_view source, iter first, iter end) {
     assert(is_head(*first));
 
-    auto last = find_last_contiguous(first, end, is_ident);
-    auto next_iter = std::next(last);
+    auto next_iter = kn::lexer::skip_ident(std::next(first), end);
 
-    auto ident = std::string_view(
-      first.base(), static_cast<std::size_t>(next_iter.base() - first.base()));
+    auto ident = std::string_view(first, distance(first, next_iter));
     return ParseResult{
-      { kn::lexer::Identifier{ ident }, first.pos(), last.pos() },
+      { kn::lexer::Identifier{ ident, kn::intern_hash(ident) }, offset_of(source, first), ident.size() },
       next_iter
     };
   }
 
-  ParseResult parse_function(iter first, iter end) {
-    if (is_func_head(*first)) {
-      auto last = find_last_contiguous(first, end, is_func_cont);
-      auto next_iter = std::next(last);
-      return { { kn::lexer::Function{ *first }, first.pos(), last.pos() }, next_iter };
-    } else {
-      auto next_iter = std::next(first);
-      return { { kn::lexer::Function{ *first }, first.pos() }, next_iter };
-    }
+  ParseResult parse_function(std::string_view source, iter first, iter end) {
+    auto next_iter = std::next(first);
+    if (is_func_head(*first))
+      next_iter = kn::lexer::skip_func_word(next_iter, end);
+    return ParseResult{
+      { kn::lexer::Function{ *first }, offset_of(source, first), distance(first, next_iter) },
+      next_iter
+    };
   }
 
 }
 
 namespace kn::lexer {
 
-  std::vector<Token> tokenise(std::string_view str) {
-    auto results = std::vector<Token>{};
+  struct Lexer::Chunks {
+    // a chunk of the source that's been lexed on another thread, assuming
+    // that it didn't start in the middle of a string literal; that only
+    // holds if the previous chunk's tokens stopped exactly where it starts
+    struct Lexed {
+      std::vector<Token> tokens = {};
+      const char* first = nullptr;
+      const char* limit = nullptr;
+      const char* stop = nullptr;
+      // thrown once all the tokens before it have been used
+      std::exception_ptr error = nullptr;
+    };
 
-    // don't use .begin()/.end(), since not guaranteed be a char*
-    auto it = SourceIterator(str.data());
-    auto end = SourceIterator(str.data() + str.size());
+    static Lexed lex(std::string_view source, const char* first, const char* limit) {
+      auto result = Lexed{ {}, first, limit, first, nullptr };
+      auto lexer = Lexer(source, first, limit);
+      try {
+        while (auto tok = lexer.next_here())
+          result.tokens.push_back(*tok);
+      } catch (...) {
+        result.error = std::current_exception();
+      }
+      result.stop = lexer.m_it;
+      return result;
+    }
 
-    while (it != end) {
+    // keep up to `window` chunks being lexed ahead of the parser
+    void launch() {
+      auto end = source.data() + source.size();
+      while (ahead.size() < window and next_first != end) {
+        auto first = next_first;
+        // chunks end just after a newline, so only a string can cross over
+        auto limit = end;
+        if (static_cast<std::size_t>(end - first) > chunk_size) {
+          limit = find_char(first + chunk_size, end, '\n');
+          if (limit != end)
+            ++limit;
+        }
+        next_first = limit;
+        ahead.push_back(std::async(std::launch::async, lex, source, first, limit));
+      }
+    }
+
+    std::string_view source;
+    std::size_t window;
+    const char* next_first;
+    std::deque<std::future<Lexed>> ahead = {};
+    Lexed current = {};
+    std::size_t used = 0;
+  };
+
+  Lexer::Lexer(std::string_view source, std::size_t threads)
+    : Lexer(source, source.data(), source.data() + source.size())
+  {
+    if (threads == 0 and source.size() >= parallel_threshold)
+      threads = std::thread::hardware_concurrency();
+    if (threads <= 1)
+      return;
+
+    m_chunks = std::make_unique<Chunks>(Chunks{ source, threads, source.data() });
+    m_chunks->current.stop = source.data();
+    m_chunks->launch();
+  }
+
+  Lexer::Lexer(std::string_view source, const char* first, const char* limit) noexcept
+    : m_source(source)
+    , m_it(first)
+    , m_limit(limit)
+    , m_chunks()
+  {}
+
+  Lexer::~Lexer() = default;
+  Lexer::Lexer(Lexer&&) noexcept = default;
+  Lexer& Lexer::operator=(Lexer&&) noexcept = default;
+
+  std::optional<Token> Lexer::next() {
+    if (not m_chunks)
+      return next_here();
+
+    auto& chunks = *m_chunks;
+    while (chunks.used == chunks.current.tokens.size()) {
+      if (chunks.current.error)
+        std::rethrow_exception(chunks.current.error);
+      if (chunks.ahead.empty())
+        return std::nullopt;
+
+      auto lexed = chunks.ahead.front().get();
+      chunks.ahead.pop_front();
+      chunks.launch();
+
+      // a string ran on from the last chunk, so this one was lexed wrong;
+      // start it again from where the string actually finished
+      if (lexed.first != chunks.current.stop)
+        lexed = Chunks::lex(m_source, chunks.current.stop, lexed.limit);
+
+      chunks.current = std::move(lexed);
+      chunks.used = 0;
+    }
+    return chunks.current.tokens[chunks.used++];
+  }
+
+  std::optional<Token> Lexer::next_here() {
+    auto& it = m_it;
+    auto end = m_source.data() + m_source.size();
+
+    while (it < m_limit) {
       switch (*it) {
       case '\t': case '\n': case '\r':
       case ' ': case ':':
@@ -129,45 +232,47 @@ namespace kn::lexer {
       case '[': case ']':
       case '{': case '}': {
         // whitespace
-        ++it;
+        it = skip_blanks(it, m_limit);
         break;
       }
 
       case '#': {
         // comments
-        it = std::find(it, end, '\n');
+        it = find_char(it, end, '\n');
       } break;
 
       case '\'': case '"': {
         // string literals
-        auto result = parse_string_literal(it, end);
+        auto result = parse_string_literal(m_source, it, end);
         it = result.next_iter;
-        results.push_back(std::move(result).token);
-      } break;
+        return std::move(result).token;
+      }
 
       case '0': case '1': case '2': case '3': case '4':
       case '5': case '6': case '7': case '8': case '9': {
         // numeric literals
-        auto result = parse_numeric_literal(it, end);
+        auto result = parse_numeric_literal(m_source, it, end);
         it = result.next_iter;
-        results.push_back(std::move(result).token);
-      } break;
+        return std::move(result).token;
+      }
 
-      default:
+      default: {
         // everything else
-        if (is_head(*it)) {
-          auto result = parse_identifier(it, end);
-          it = result.next_iter;
-          results.push_back(std::move(result).token);
-        } else {
-          auto result = parse_function(it, end);
-          it = result.next_iter;
-          results.push_back(std::move(result).token);
-        }
+        auto result = is_head(*it)
+          ? parse_identifier(m_source, it, end)
+          : parse_function(m_source, it, end);
+        it = result.next_iter;
+        return std::move(result).token;
+      }
       }
     }
 
-    return results;
+    return std::nullopt;
+  }
+
+  std::pair<SourcePosition, SourcePosition> Lexer::range(const Token& tok) const {
+    auto first = m_source.data() + tok.offset();
+    return range_of(m_source, first, first + tok.length());
   }
 
 }
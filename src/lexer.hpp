@@ -1,17 +1,20 @@
 #ifndef KNIGHT_LEXER_HPP_INCLUDED
 #define KNIGHT_LEXER_HPP_INCLUDED
 
+#include <cstddef>
+#include <memory>
+#include <optional>
 #include <ostream>
 #include <string_view>
 #include <utility>
 #include <variant>
-#include <vector>
 #include "sourcepos.hpp"
 
 namespace kn::lexer {
 
   struct StringLiteral {
     std::string_view data;
+    std::size_t hash;
     friend std::ostream& operator<<(std::ostream& os, StringLiteral s) {
       return os << "STRING_LITERAL(" << s.data << ")";
     }
@@ -24,6 +27,7 @@ namespace kn::lexer {
   };
   struct Identifier {
     std::string_view name;
+    std::size_t hash;
     friend std::ostream& operator<<(std::ostream& os, Identifier i) {
       return os << "IDENTIFIER(" << i.name << ")";
     }
@@ -35,38 +39,29 @@ namespace kn::lexer {
     }
   };
 
+  // tokens only remember where they are as a byte offset into the source;
+  // the lexer can turn that into lines and columns if an error needs it
   class Token {
   public:
-    Token(StringLiteral data, SourcePosition first, SourcePosition last) noexcept
-      : m_data(data), m_first(first), m_last(last)
+    Token(StringLiteral data, std::size_t offset, std::size_t length) noexcept
+      : m_data(data), m_offset(offset), m_length(length)
     {}
-    Token(NumericLiteral data, SourcePosition first, SourcePosition last) noexcept
-      : m_data(data), m_first(first), m_last(last)
+    Token(NumericLiteral data, std::size_t offset, std::size_t length) noexcept
+      : m_data(data), m_offset(offset), m_length(length)
     {}
-    Token(Identifier data, SourcePosition first, SourcePosition last) noexcept
-      : m_data(data), m_first(first), m_last(last)
+    Token(Identifier data, std::size_t offset, std::size_t length) noexcept
+      : m_data(data), m_offset(offset), m_length(length)
     {}
-    Token(Function data, SourcePosition first, SourcePosition last) noexcept
-      : m_data(data), m_first(first), m_last(last)
+    Token(Function data, std::size_t offset, std::size_t length) noexcept
+      : m_data(data), m_offset(offset), m_length(length)
     {}
 
-    template <typename T>
-    Token(T data, SourcePosition pos) noexcept
-      : Token(std::move(data), pos, pos)
-    {}
-
-    SourcePosition pos() const noexcept { return m_first; }
-
-    std::pair<SourcePosition, SourcePosition> range() const noexcept {
-      return { m_first, m_last };
-    }
+    std::size_t offset() const noexcept { return m_offset; }
+    std::size_t length() const noexcept { return m_length; }
 
     friend std::ostream& operator<<(std::ostream& os, const Token& tok) {
       std::visit([&os](auto&& t) { os << t; }, tok.m_data);
-      os << " @ " << tok.m_first.to_string();
-      if (tok.m_first != tok.m_last)
-        os << "#" << tok.m_last.to_string();
-      return os;
+      return os << " @ " << tok.m_offset << "+" << tok.m_length;
     }
 
     const StringLiteral* as_string_lit() const noexcept {
@@ -84,12 +79,42 @@ namespace kn::lexer {
 
   private:
     std::variant<StringLiteral, NumericLiteral, Identifier, Function> m_data;
-    SourcePosition m_first;
-    SourcePosition m_last;
+    std::size_t m_offset;
+    std::size_t m_length;
   };
 
-  std::vector<Token> tokenise(std::string_view str);
-  using TokenIter = std::vector<Token>::const_iterator;
+  // produces tokens one at a time as the parser asks for them,
+  // so that the whole token stream never has to be held at once;
+  // large sources are split into chunks that other threads lex ahead
+  class Lexer {
+  public:
+    // lex `source` using up to `threads` threads; zero picks a number
+    // based on the size of the source and the hardware
+    explicit Lexer(std::string_view source, std::size_t threads = 0);
+    ~Lexer();
+
+    Lexer(Lexer&&) noexcept;
+    Lexer& operator=(Lexer&&) noexcept;
+
+    // the next token in the source, or nullopt once it's exhausted
+    std::optional<Token> next();
+
+    // where `tok` starts and ends, as lines and columns
+    std::pair<SourcePosition, SourcePosition> range(const Token& tok) const;
+
+  private:
+    struct Chunks;
+
+    // lex just the tokens that start before `limit`, beginning at `first`
+    Lexer(std::string_view source, const char* first, const char* limit) noexcept;
+
+    std::optional<Token> next_here();
+
+    std::string_view m_source;
+    const char* m_it;
+    const char* m_limit;
+    std::unique_ptr<Chunks> m_chunks;
+  };
 
 }
 
@@ -1,22 +1,36 @@
+#include <algorithm>
 #include <iterator>
 #include <iostream>
 #include <iomanip>
-#include <fstream>
+#include <optional>
 #include <string>
 #include <chrono>
+#include <thread>
 
+#include "batch.hpp"
+#include "deferred.hpp"
+#include "direct.hpp"
+#include "env.hpp"
 #include "error.hpp"
 #include "eval.hpp"
 #include "funcs.hpp"
+#include "image.hpp"
+#include "input.hpp"
 #include "ir.hpp"
 #include "lexer.hpp"
+#include "mapping.hpp"
+#include "output.hpp"
 #include "parser.hpp"
+#include "random.hpp"
+#include "scan.hpp"
+#include "server.hpp"
 
 namespace {
 
   std::chrono::system_clock::time_point start;
   std::chrono::system_clock::time_point after_parsing;
   std::chrono::system_clock::time_point after_assembling;
+  kn::eval::EvalCache::Stats eval_stats;
   void on_exit() {
     using namespace std::chrono;
     using ms = duration<double, std::milli>;
@@ -31,6 +45,146 @@ namespace {
       << ms(end - after_assembling).count() << "ms\n";
     std::cerr << "total (excluding input): " << std::setw(12)
       << ms(end - start).count() << "ms\n";
+    std::cerr << "eval cache hits/misses:  " << std::setw(12)
+      << eval_stats.hits << " / " << eval_stats.misses
+      << " (" << eval_stats.evictions << " evicted)\n";
+  }
+
+  void register_timer() {
+    if (std::atexit(on_exit) != 0)
+      std::cerr << "warning: could not register timer function\n";
+  }
+
+  // compile without optimising, for scripts that won't run for long
+  bool single_pass = false;
+
+  // the source has to outlive the code, since literals refer into it
+  kn::eval::ByteCode compile(std::string_view source, std::size_t offset = 0) {
+    if (single_pass) {
+      auto code = kn::parser::compile(source, kn::parser::Literals::Borrow).code;
+      kn::eval::relocate(code, offset);
+      return code;
+    }
+    auto parsed = kn::parser::parse(source, kn::parser::Literals::Borrow);
+    auto program = kn::ir::optimise(parsed);
+    return kn::eval::prepare(program, offset);
+  }
+
+  // lex `source` with each instruction set this CPU has, and then on
+  // as many threads as there are, reporting how fast each went;
+  // small sources are lexed repeatedly for a fairer sample
+  int bench_lexer(std::string_view source) {
+    using kn::lexer::Isa;
+
+    auto report = [source](std::string_view name, std::size_t threads) {
+      using namespace std::chrono;
+      constexpr auto min_bytes = std::size_t{ 256 } << 20;
+
+      auto tokens = std::size_t{ 0 };
+      auto bytes = std::size_t{ 0 };
+      auto before = steady_clock::now();
+      do {
+        auto lexer = kn::lexer::Lexer(source, threads);
+        while (lexer.next())
+          ++tokens;
+        bytes += source.size();
+      } while (bytes < min_bytes);
+      auto seconds = duration<double>(steady_clock::now() - before).count();
+
+      std::cout << std::setw(8) << name << ": "
+        << std::setw(10) << static_cast<double>(bytes) / seconds / 1e6 << " MB/s, "
+        << tokens / (bytes / source.size()) << " tokens\n";
+    };
+
+    std::cout << "source: " << source.size() << " bytes\n";
+    std::cout << std::fixed << std::setprecision(1);
+    for (auto isa : { Isa::Scalar, Isa::SSE2, Isa::AVX2 })
+      if (kn::lexer::use_isa(isa))
+        report(kn::lexer::isa_name(isa), 1);
+
+    auto threads = std::max(std::thread::hardware_concurrency(), 1u);
+    kn::lexer::use_isa(kn::lexer::best_isa());
+    report("threads", threads);
+    return 0;
+  }
+
+  // compile once, then run the program for every line of stdin,
+  // each time starting from the variables left behind by the prelude;
+  // `bytecode` holds anything loaded from an image
+  int run_each_line(
+    kn::eval::ByteCode bytecode,
+    std::string_view input,
+    std::string_view prelude,
+    const std::string& save_path,
+    bool timeit)
+  {
+    auto& env = kn::eval::Environment::get();
+
+    auto prelude_entry = bytecode.size();
+    if (not prelude.empty()) {
+      auto code = compile(prelude, prelude_entry);
+      bytecode.insert(bytecode.end(), code.begin(), code.end());
+    }
+    // the prelude may have been nothing but blanks and comments
+    auto has_prelude = bytecode.size() != prelude_entry;
+    auto entry = bytecode.size();
+    auto program = compile(input, entry);
+    bytecode.insert(bytecode.end(), program.begin(), program.end());
+    after_parsing = after_assembling = std::chrono::system_clock::now();
+    if (timeit)
+      register_timer();
+
+    if (has_prelude) {
+      auto status = kn::eval::run(bytecode, prelude_entry);
+      if (env.exit_code())
+        return status;
+    }
+    auto snapshot = env.snapshot();
+    if (not save_path.empty())
+      kn::eval::save_image(save_path, { snapshot, bytecode });
+
+    auto records = kn::eval::Input(0);
+    while (auto line = records.read_string()) {
+      // PROMPT gives the current line, and nothing after it
+      auto record = kn::eval::Input(std::move(*line));
+      env.set_io(record, std::cout);
+      env.restore_variables(snapshot);
+
+      auto status = kn::eval::run(bytecode, entry);
+      eval_stats = env.evals().stats();
+      if (env.exit_code())
+        return status;
+    }
+    return 0;
+  }
+
+  // send everything written to std::cout through our own buffer,
+  // flushing it when main returns
+  class BufferedStdout {
+  public:
+    BufferedStdout()
+      : buffer(1)
+      , previous(std::cout.rdbuf(&buffer))
+    {}
+    ~BufferedStdout() {
+      std::cout.flush();
+      std::cout.rdbuf(previous);
+    }
+
+  private:
+    kn::eval::Output buffer;
+    std::streambuf* previous;
+  };
+
+  // unless told otherwise, keep up with anyone watching the output
+  // or typing in the input, and otherwise only write full blocks
+  kn::eval::Environment::Flush default_flush_policy() {
+    using Flush = kn::eval::Environment::Flush;
+    if (kn::eval::is_terminal(1))
+      return Flush::EveryLine;
+    if (kn::eval::is_terminal(0))
+      return Flush::BeforeInput;
+    return Flush::AtExit;
   }
 
   void print_help_string(std::ostream& os, const char* program_name) {
@@ -39,31 +193,125 @@ namespace {
 #ifdef KN_HAS_DEBUGGER
       << " [--debug]"
 #endif
-      << " [--time] [(-e <expr> | -f <filename>)]\n";
+      << " [--time] [-O0] [--flush (exit | input | line)] [--eval-cache <n>]"
+      << " [--persistent-shell | --async-shell] [--seed <n>]"
+      << " [--image <filename>] [--save-image <filename>]"
+      << " [(-e <expr> | -f <filename>)]\n"
+      << "       " << program_name
+      << " [--time] [-O0] --each-line [--prelude <filename>] (-e <expr> | -f <filename>)\n"
+      << "       " << program_name
+      << " --batch <dir | manifest> [--jobs <n> | --green [--slice <n>]]"
+      << " [--out <dir>]\n"
+      << "       " << program_name
+      << " --serve <socket> [--jobs <n>]\n"
+      << "       " << program_name
+      << " --client <socket> (-e <expr> | -f <filename>)\n"
+      << "       " << program_name
+      << " --bench-lexer (-e <expr> | -f <filename>)\n";
   }
 }
 
 int main([[maybe_unused]] int argc, char** argv) {
   using namespace std::literals;
 
-  auto input = std::string{};
+  std::ios::sync_with_stdio(false);
+  auto stdout_buffer = BufferedStdout{};
+
+  // where the program comes from: a mapped file, an argument, or stdin
+  auto input = std::string_view{};
+  auto input_file = std::optional<kn::MappedFile>{};
+  auto stdin_input = std::string{};
 
   auto supplied_input = false;
   auto timeit = false;
+  auto each_line = false;
+  auto prelude = std::string_view{};
+  auto prelude_file = std::optional<kn::MappedFile>{};
+  auto image_path = std::string{};
+  auto save_path = std::string{};
+  auto batch = std::optional<kn::batch::Options>{};
+  auto jobs = std::size_t{ 0 };
+  auto out_dir = std::string{ "." };
+  auto green = false;
+  auto slice = std::size_t{ 10000 };
+  auto serve_path = std::string{};
+  auto client_path = std::string{};
+  auto eval_cache = std::optional<std::size_t>{};
+  auto flush = default_flush_policy();
+  auto persistent_shell = false;
+  auto async_shell = false;
+  auto lexer_bench = false;
 #ifdef KN_HAS_DEBUGGER
   auto should_run_debugger = false;
 #endif
 
   for (char** curr_arg = argv + 1; *curr_arg != nullptr; ++curr_arg) {
     if (*curr_arg == "-f"sv and not supplied_input) {
-      std::ifstream f(*++curr_arg);
-      input.insert(input.end(), std::istreambuf_iterator<char>(f), {});
+      try {
+        input = input_file.emplace(*++curr_arg).data();
+      } catch (const kn::Error& err) {
+        std::cerr << err.what() << '\n';
+        return 1;
+      }
       supplied_input = true;
     } else if (*curr_arg == "-e"sv and not supplied_input) {
       input = *++curr_arg;
       supplied_input = true;
     } else if (*curr_arg == "--time"sv) {
       timeit = true;
+    } else if (*curr_arg == "--flush"sv) {
+      using Flush = kn::eval::Environment::Flush;
+      auto when = std::string_view(*++curr_arg);
+      if (when == "exit"sv) {
+        flush = Flush::AtExit;
+      } else if (when == "input"sv) {
+        flush = Flush::BeforeInput;
+      } else if (when == "line"sv) {
+        flush = Flush::EveryLine;
+      } else {
+        std::cerr << "unknown flush policy \"" << when << "\"\n";
+        return 1;
+      }
+    } else if (*curr_arg == "-O0"sv) {
+      single_pass = true;
+    } else if (*curr_arg == "--seed"sv) {
+      kn::eval::Random::set_default_seed(std::stoull(*++curr_arg));
+    } else if (*curr_arg == "--persistent-shell"sv) {
+      persistent_shell = true;
+    } else if (*curr_arg == "--async-shell"sv) {
+      async_shell = true;
+    } else if (*curr_arg == "--eval-cache"sv) {
+      eval_cache = std::stoul(*++curr_arg);
+    } else if (*curr_arg == "--bench-lexer"sv) {
+      lexer_bench = true;
+    } else if (*curr_arg == "--each-line"sv) {
+      each_line = true;
+    } else if (*curr_arg == "--prelude"sv) {
+      try {
+        prelude = prelude_file.emplace(*++curr_arg).data();
+      } catch (const kn::Error& err) {
+        std::cerr << err.what() << '\n';
+        return 1;
+      }
+    } else if (*curr_arg == "--image"sv) {
+      image_path = *++curr_arg;
+    } else if (*curr_arg == "--save-image"sv) {
+      save_path = *++curr_arg;
+    } else if (*curr_arg == "--batch"sv) {
+      batch.emplace();
+      batch->source = *++curr_arg;
+    } else if (*curr_arg == "--jobs"sv) {
+      jobs = std::stoul(*++curr_arg);
+    } else if (*curr_arg == "--out"sv) {
+      out_dir = *++curr_arg;
+    } else if (*curr_arg == "--green"sv) {
+      green = true;
+    } else if (*curr_arg == "--slice"sv) {
+      slice = std::stoul(*++curr_arg);
+    } else if (*curr_arg == "--serve"sv) {
+      serve_path = *++curr_arg;
+    } else if (*curr_arg == "--client"sv) {
+      client_path = *++curr_arg;
 #ifdef KN_HAS_DEBUGGER
     } else if (*curr_arg == "--debug"sv) {
       should_run_debugger = true;
@@ -78,8 +326,66 @@ int main([[maybe_unused]] int argc, char** argv) {
     }
   }
 
+  // each asynchronous command runs on its own thread, so wouldn't share
+  if (persistent_shell and async_shell) {
+    std::cerr << "--persistent-shell and --async-shell can't be used together\n";
+    return 1;
+  }
+  kn::funcs::set_persistent_shell(persistent_shell);
+  kn::funcs::set_async_shell(async_shell);
+
+  if (batch) {
+    // a task has to get something done each turn, or the others never would
+    if (green and slice == 0) {
+      std::cerr << "--slice must be at least 1\n";
+      return 1;
+    }
+    batch->jobs = jobs;
+    batch->out_dir = out_dir;
+    batch->green = green;
+    batch->slice = slice;
+    if (eval_cache)
+      batch->eval_cache = *eval_cache;
+    try {
+      return kn::batch::run(*batch);
+    } catch (const kn::Error& err) {
+      std::cerr << err.what() << '\n';
+      return 1;
+    }
+  }
+
+  if (not serve_path.empty()) {
+    try {
+      return kn::server::serve(
+        serve_path, jobs, eval_cache.value_or(kn::eval::EvalCache::default_capacity));
+    } catch (const kn::Error& err) {
+      std::cerr << err.what() << '\n';
+      return 1;
+    }
+  }
+
+  if (not client_path.empty()) {
+    if (not supplied_input) {
+      std::cerr << "--client sends stdin as input, so needs -e or -f\n";
+      return 1;
+    }
+    try {
+      auto data = std::string(std::istreambuf_iterator<char>(std::cin), {});
+      return kn::server::submit(client_path, input, data);
+    } catch (const kn::Error& err) {
+      std::cerr << err.what() << '\n';
+      return 1;
+    }
+  }
+
+  if (each_line and not supplied_input) {
+    std::cerr << "--each-line reads records from stdin, so needs -e or -f\n";
+    return 1;
+  }
+
   if (not supplied_input) {
-    input.insert(input.end(), std::istreambuf_iterator<char>(std::cin), {});
+    stdin_input.assign(std::istreambuf_iterator<char>(std::cin), {});
+    input = stdin_input;
   }
 
   if (input.empty()) {
@@ -87,30 +393,68 @@ int main([[maybe_unused]] int argc, char** argv) {
     return 1;
   }
 
+  if (lexer_bench) {
+    try {
+      return bench_lexer(input);
+    } catch (const kn::Error& err) {
+      std::cerr << err.what() << '\n';
+      return 1;
+    }
+  }
+
   try {
+    // start from a saved image, with new code going after it
+    auto bytecode = kn::eval::ByteCode{};
+    if (not image_path.empty()) {
+      auto image = kn::eval::load_image(image_path);
+      kn::eval::Environment::get().restore(std::move(image.env));
+      bytecode = std::move(image.code);
+    }
+    // how many code points EVAL can keep around before reusing them
+    if (eval_cache)
+      kn::eval::Environment::get().evals().set_capacity(*eval_cache);
+    kn::eval::Environment::get().set_flush_policy(flush);
+
     start = std::chrono::system_clock::now();
 
-    auto tokens = kn::lexer::tokenise(input);
-    auto parsed = kn::parser::parse(tokens);
-    after_parsing = std::chrono::system_clock::now();
+    if (each_line)
+      return run_each_line(std::move(bytecode), input, prelude, save_path, timeit);
 
-    auto program = kn::ir::optimise(parsed);
-    auto bytecode = kn::eval::prepare(program);
-    after_assembling = std::chrono::system_clock::now();
+    // blocks are left to be compiled when they're first called
+    auto deferred = kn::ir::Deferred{};
+    kn::eval::Environment::get().set_deferred(&deferred);
 
-    if (timeit) {
-      if (std::atexit(on_exit) != 0)
-        std::cerr << "warning: could not register timer function\n";
+    auto entry = bytecode.size();
+    auto code = kn::eval::ByteCode{};
+    if (single_pass) {
+      code = compile(input, entry);
+      after_parsing = std::chrono::system_clock::now();
+    } else {
+      auto parsed = kn::parser::parse(input, kn::parser::Literals::Borrow);
+      after_parsing = std::chrono::system_clock::now();
+      code = deferred.prepare(std::move(parsed), entry);
     }
+    bytecode.insert(bytecode.end(), code.begin(), code.end());
+    after_assembling = std::chrono::system_clock::now();
+
+    if (timeit)
+      register_timer();
 
 #ifdef KN_HAS_DEBUGGER
-    if (should_run_debugger)
-      kn::eval::debug(std::move(bytecode));
-    else
-      kn::eval::run(std::move(bytecode));
-#else
-    kn::eval::run(std::move(bytecode));
+    if (should_run_debugger) {
+      kn::eval::debug(std::move(bytecode), entry);
+      return 0;
+    }
 #endif
+    auto status = kn::eval::run(bytecode, entry);
+    auto& env = kn::eval::Environment::get();
+    eval_stats = env.evals().stats();
+    if (not save_path.empty()) {
+      // the image has to stand on its own
+      deferred.compile_all(bytecode);
+      kn::eval::save_image(save_path, { env.snapshot(), bytecode });
+    }
+    return status;
   } catch (const kn::Error& err) {
     std::cout << err.what() << '\n';
     return 1;
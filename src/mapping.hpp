@@ -0,0 +1,33 @@
+#ifndef KNIGHT_MAPPING_HPP_INCLUDED
+#define KNIGHT_MAPPING_HPP_INCLUDED
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace kn {
+
+  // a read-only view of an entire file, memory-mapped where possible;
+  // things that can't be mapped (e.g. pipes) are read into memory instead
+  class MappedFile {
+  public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view data() const noexcept {
+      return { m_data, m_size };
+    }
+
+  private:
+    const char* m_data;
+    std::size_t m_size;
+    void* m_handle;
+    std::string m_fallback;
+  };
+
+}
+
+#endif  // KNIGHT_MAPPING_HPP_INCLUDED
@@ -0,0 +1,47 @@
+// this is pretty dodgy
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapping.hpp"
+#include "error.hpp"
+
+kn::MappedFile::MappedFile(const std::string& path)
+  : m_data(nullptr), m_size(0), m_handle(nullptr), m_fallback()
+{
+  auto fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw kn::Error("error: unable to open " + path);
+
+  struct stat info{};
+  if (::fstat(fd, &info) == 0 and S_ISREG(info.st_mode) and info.st_size > 0) {
+    auto size = static_cast<std::size_t>(info.st_size);
+    auto p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      ::close(fd);
+      m_handle = p;
+      m_data = static_cast<const char*>(p);
+      m_size = size;
+      return;
+    }
+  }
+
+  // not something we can map, so just read it all in
+  char buffer[4096];
+  while (true) {
+    auto read = ::read(fd, buffer, sizeof buffer);
+    if (read <= 0)
+      break;
+    m_fallback.append(buffer, static_cast<std::size_t>(read));
+  }
+  ::close(fd);
+  m_data = m_fallback.data();
+  m_size = m_fallback.size();
+}
+
+kn::MappedFile::~MappedFile() {
+  if (m_handle)
+    ::munmap(m_handle, m_size);
+}
@@ -0,0 +1,50 @@
+#include <Windows.h>
+#include <fstream>
+#include <iterator>
+
+#include "mapping.hpp"
+#include "error.hpp"
+
+kn::MappedFile::MappedFile(const std::string& path)
+  : m_data(nullptr), m_size(0), m_handle(nullptr), m_fallback()
+{
+  auto file = CreateFileA(
+    path.c_str(),
+    GENERIC_READ,
+    FILE_SHARE_READ,
+    nullptr,
+    OPEN_EXISTING,
+    FILE_ATTRIBUTE_NORMAL,
+    nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    throw kn::Error("error: unable to open " + path);
+
+  auto size = LARGE_INTEGER{};
+  if (GetFileType(file) == FILE_TYPE_DISK
+      and GetFileSizeEx(file, &size) and size.QuadPart > 0) {
+    auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping) {
+      auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);
+      if (view) {
+        CloseHandle(file);
+        m_handle = view;
+        m_data = static_cast<const char*>(view);
+        m_size = static_cast<std::size_t>(size.QuadPart);
+        return;
+      }
+    }
+  }
+  CloseHandle(file);
+
+  // not something we can map, so just read it all in
+  auto f = std::ifstream(path, std::ios::binary);
+  m_fallback.assign(std::istreambuf_iterator<char>(f), {});
+  m_data = m_fallback.data();
+  m_size = m_fallback.size();
+}
+
+kn::MappedFile::~MappedFile() {
+  if (m_handle)
+    UnmapViewOfFile(m_handle);
+}
@@ -0,0 +1,122 @@
+#include "output.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+  constexpr std::size_t block_size = 256 * 1024;
+
+#ifdef _WIN32
+  bool write_all(int fd, const char* data, std::size_t size) {
+    while (size != 0) {
+      auto n = ::_write(fd, data, static_cast<unsigned>(size));
+      if (n <= 0)
+        return false;
+      data += n;
+      size -= static_cast<std::size_t>(n);
+    }
+    return true;
+  }
+#endif
+
+  // write both pieces in as few calls as possible
+  bool write_both(int fd, const char* a, std::size_t a_size,
+                  const char* b, std::size_t b_size) {
+#ifdef _WIN32
+    return write_all(fd, a, a_size) and write_all(fd, b, b_size);
+#else
+    iovec parts[2] = {
+      { const_cast<char*>(a), a_size },
+      { const_cast<char*>(b), b_size },
+    };
+    auto* part = parts;
+    auto count = 2;
+    while (count != 0) {
+      auto n = ::writev(fd, part, count);
+      if (n < 0 and errno == EINTR)
+        continue;
+      if (n < 0)
+        return false;
+
+      // skip over whatever made it out, which may be part of a piece
+      auto written = static_cast<std::size_t>(n);
+      while (count != 0 and written >= part->iov_len) {
+        written -= part->iov_len;
+        ++part;
+        --count;
+      }
+      if (count != 0) {
+        part->iov_base = static_cast<char*>(part->iov_base) + written;
+        part->iov_len -= written;
+      }
+    }
+    return true;
+#endif
+  }
+
+}
+
+namespace kn::eval {
+
+  Output::Output(int fd)
+    : fd(fd)
+    , buffer(block_size)
+  {
+    setp(buffer.data(), buffer.data() + buffer.size());
+  }
+
+  Output::~Output() {
+    sync();
+  }
+
+  Output::int_type Output::overflow(int_type c) {
+    if (sync() != 0)
+      return traits_type::eof();
+    if (not traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  std::streamsize Output::xsputn(const char* data, std::streamsize size) {
+    auto n = static_cast<std::size_t>(size);
+    if (n <= static_cast<std::size_t>(epptr() - pptr())) {
+      std::memcpy(pptr(), data, n);
+      pbump(static_cast<int>(size));
+      return size;
+    }
+
+    // no room, so this is going out now anyway: do it without copying
+    return write_through(data, n) ? size : 0;
+  }
+
+  int Output::sync() {
+    return write_through(nullptr, 0) ? 0 : -1;
+  }
+
+  bool Output::write_through(const char* data, std::size_t size) {
+    auto buffered = static_cast<std::size_t>(pptr() - pbase());
+    if (buffered == 0 and size == 0)
+      return true;
+    setp(buffer.data(), buffer.data() + buffer.size());
+    return write_both(fd, buffer.data(), buffered, data, size);
+  }
+
+  bool is_terminal(int fd) noexcept {
+#ifdef _WIN32
+    return ::_isatty(fd) != 0;
+#else
+    return ::isatty(fd) != 0;
+#endif
+  }
+
+}
@@ -0,0 +1,39 @@
+#ifndef KNIGHT_OUTPUT_HPP_INCLUDED
+#define KNIGHT_OUTPUT_HPP_INCLUDED
+
+#include <streambuf>
+#include <vector>
+
+namespace kn::eval {
+
+  // block-buffered output to a file descriptor; anything too big to
+  // be worth copying into the buffer is written straight through,
+  // together with whatever was already buffered
+  class Output : public std::streambuf {
+  public:
+    // write to the file descriptor `fd`, which remains owned by the caller
+    explicit Output(int fd);
+    ~Output() override;
+
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+
+  protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char* data, std::streamsize size) override;
+    int sync() override;
+
+  private:
+    // write out the buffer followed by `size` bytes of `data`
+    bool write_through(const char* data, std::size_t size);
+
+    int fd;
+    std::vector<char> buffer;
+  };
+
+  // whether `fd` refers to a terminal, which expects to see output promptly
+  bool is_terminal(int fd) noexcept;
+
+}
+
+#endif  // KNIGHT_OUTPUT_HPP_INCLUDED
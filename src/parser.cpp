@@ -67,8 +67,15 @@ namespace {
 
 namespace kn::parser {
 
-  std::vector<Block> parse(const std::vector<kn::lexer::Token>& tokens) {
-    if (tokens.empty())
+  int arity(char f) noexcept {
+    auto [n, fn] = emitters[static_cast<unsigned char>(f)];
+    return fn ? n : -1;
+  }
+
+  Program parse(std::string_view source, Literals literals) {
+    auto lexer = kn::lexer::Lexer(source);
+    auto tok = lexer.next();
+    if (not tok)
       return {};
 
     ParseInfo info;
@@ -87,17 +94,21 @@ namespace kn::parser {
     //   - we had an expression with missing arguments
     // if we run out of stack while tokens still have stuff:
     //   - we have random junk on the end
-    // we finish iff (it == tokens.end() and expr_stack.size() == 1)
-    auto it = tokens.begin();
-    for (; it != tokens.end(); ++it) {
+    // we finish iff (tok == nullopt and expr_stack.size() == 1)
+    // tokens are pulled from the lexer as needed, and never stored
+    for (; tok; tok = lexer.next()) {
+      auto it = &*tok;
       if (auto s = it->as_string_lit()) {
-        top().add_child(env.get_string_literal(std::string(s->data)));
+        if (literals == Literals::Borrow)
+          top().add_child(env.get_borrowed_literal(s->data, s->hash));
+        else
+          top().add_child(env.get_string_literal(s->data, s->hash));
       }
       else if (auto n = it->as_numeric_lit()) {
         top().add_child(eval::Label::from_constant(n->data));
       }
       else if (auto i = it->as_ident()) {
-        top().add_child(env.get_variable(std::string(i->name)));
+        top().add_child(env.get_variable(i->name, i->hash));
       }
       else if (auto f = it->as_function()) {
         auto f_id = static_cast<std::size_t>(f->id);
@@ -110,11 +121,11 @@ namespace kn::parser {
             if (f_id == 'B') info.push_frame();
           }
         } else {
-          throw kn::Error(it->range(), "error: unknown function");
+          throw kn::Error(lexer.range(*it), "error: unknown function");
         }
       }
       else {
-        throw kn::Error(it->range(), "error: unknown token type");
+        throw kn::Error(lexer.range(*it), "error: unknown token type");
       }
 
       // TODO: neaten?
@@ -122,17 +133,17 @@ namespace kn::parser {
       while (top().is_completed()) {
         if (stack.size() == 1) {
           // hit bottom of stack, we're done
-          if (++it != tokens.end()) {
-            throw kn::Error(it->pos(), "error: unparsed tokens");
+          if (auto junk = lexer.next()) {
+            throw kn::Error(lexer.range(*junk).first, "error: unparsed tokens");
           } else {
             auto& res = top().children[0];
-            res.instructions.emplace_back(eval::OpCode::Return, res.result);
+            res.instructions.push_back(info.op(eval::OpCode::Return, res.result));
             // prepend the number of temporaries we need
-            res.instructions.emplace_front(
-              eval::OpCode::BlockData, eval::Label::from_constant(info.pop_frame()));
+            res.instructions.push_front(info.op(
+              eval::OpCode::BlockData, eval::Label::from_constant(info.pop_frame())));
             // add it to the list of blocks
             info.blocks.insert(info.blocks.begin(), std::move(res.instructions));
-            return info.blocks;
+            return { std::move(info.arena), std::move(info.blocks) };
           }
         } else {
           // pop the stack off, run the function, add to previous layer
@@ -4,9 +4,10 @@
 #include <cassert>
 #include <cstddef>
 #include <memory>
+#include <string_view>
 #include <vector>
-#include <deque>
 
+#include "arena.hpp"
 #include "value.hpp"
 #include "lexer.hpp"
 #include "eval.hpp"
@@ -15,12 +16,10 @@ namespace kn::parser {
 
   inline constexpr std::size_t max_arity = 4;
 
-  using Block = std::deque<eval::Operation>;
-
   struct Emitted {
     Emitted() = default;
     Emitted(eval::Label result) : result(result) {}
-    Emitted(eval::Label result, std::deque<eval::Operation> instructions)
+    Emitted(eval::Label result, Block instructions)
       : result(result), instructions(std::move(instructions))
     {}
 
@@ -30,6 +29,7 @@ namespace kn::parser {
 
   // general parsing stuff
   struct ParseInfo {
+    Arena arena = {};
     std::vector<Block> blocks = {};
     std::vector<std::size_t> temp_stack = { 0 };
     std::size_t jump_labels = 0;
@@ -49,6 +49,11 @@ namespace kn::parser {
     eval::Label new_jump() noexcept {
       return { eval::LabelCat::JumpTarget, jump_labels++ };
     }
+    // a new instruction, to be put in some block
+    template <typename... Args>
+    Node* op(eval::OpCode op, Args... labels) {
+      return arena.make(op, labels...);
+    }
   };
 
   // information about the current stage of parsing
@@ -72,7 +77,23 @@ namespace kn::parser {
     }
   };
 
-  std::vector<Block> parse(const std::vector<lexer::Token>& tokens);
+  // whether string literals are copied, or refer straight into the source
+  // text, which must then outlive anything that could read them
+  enum class Literals { Copy, Borrow };
+
+  // how many arguments the function `f` takes, or -1 if there's no such function
+  int arity(char f) noexcept;
+
+  // the blocks of a program, the first being where it starts
+  struct Program {
+    Arena arena = {};
+    std::vector<Block> blocks = {};
+
+    bool empty() const noexcept { return blocks.empty(); }
+  };
+
+  // lexes and parses `source` in a single pass
+  Program parse(std::string_view source, Literals literals = Literals::Copy);
 
 }
 
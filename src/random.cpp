@@ -0,0 +1,61 @@
+#include "random.hpp"
+
+#include <random>
+
+namespace {
+
+  std::optional<std::uint64_t> default_seed;
+
+  constexpr std::uint64_t rotl(std::uint64_t x, int k) noexcept {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  // used to spread a single seed over the whole state
+  std::uint64_t splitmix64(std::uint64_t& x) noexcept {
+    auto z = (x += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+  }
+
+  std::uint64_t fresh_seed() {
+    auto device = std::random_device{};
+    return (std::uint64_t{ device() } << 32) ^ device();
+  }
+
+}
+
+namespace kn::eval {
+
+  void Random::set_default_seed(std::optional<std::uint64_t> seed) noexcept {
+    default_seed = seed;
+  }
+
+  Random::Random()
+    : Random(default_seed ? *default_seed : fresh_seed())
+  {}
+
+  Random::Random(std::uint64_t seed) noexcept
+    : state()
+    , batch()
+    , used(batch.size())
+  {
+    for (auto& s : state)
+      s = splitmix64(seed);
+  }
+
+  void Random::refill() noexcept {
+    for (auto& out : batch) {
+      out = rotl(state[1] * 5, 7) * 9;
+      auto t = state[1] << 17;
+      state[2] ^= state[0];
+      state[3] ^= state[1];
+      state[1] ^= state[2];
+      state[0] ^= state[3];
+      state[2] ^= t;
+      state[3] = rotl(state[3], 45);
+    }
+    used = 0;
+  }
+
+}
@@ -0,0 +1,38 @@
+#ifndef KNIGHT_RANDOM_HPP_INCLUDED
+#define KNIGHT_RANDOM_HPP_INCLUDED
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace kn::eval {
+
+  // xoshiro256**, generated a batch at a time;
+  // small and fast, and reproducible given a seed
+  class Random {
+  public:
+    // use `seed` for every generator made from now on,
+    // or fresh entropy for each if it's nullopt (the default)
+    static void set_default_seed(std::optional<std::uint64_t> seed) noexcept;
+
+    Random();
+    explicit Random(std::uint64_t seed) noexcept;
+
+    std::uint64_t next() noexcept {
+      if (used == batch.size())
+        refill();
+      return batch[used++];
+    }
+
+  private:
+    void refill() noexcept;
+
+    std::uint64_t state[4];
+    std::array<std::uint64_t, 16> batch;
+    std::size_t used;
+  };
+
+}
+
+#endif  // KNIGHT_RANDOM_HPP_INCLUDED
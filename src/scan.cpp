@@ -0,0 +1,294 @@
+#include "scan.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KN_SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 code is only compiled in for specific functions, chosen at runtime
+#if defined(KN_SCAN_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define KN_SCAN_AVX2
+#define KN_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+  using kn::lexer::Isa;
+
+  using skip_fn = const char*(*)(const char*, const char*) noexcept;
+
+  struct Scanners {
+    Isa isa;
+    skip_fn blanks;
+    skip_fn digits;
+    skip_fn ident;
+    skip_fn func_word;
+  };
+
+  // the index of the lowest set bit of a non-zero mask
+  unsigned first_set(std::uint32_t mask) noexcept {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+  }
+
+  // each kind of character gets tested one at a time with `test`,
+  // or a vector at a time with `sse2` or `avx2`, which give a mask
+  // with every byte that's of this kind set to all ones; every
+  // character in these ranges is ASCII, so signed comparisons are fine
+
+#ifdef KN_SCAN_SSE2
+  __m128i in_range(__m128i chars, char lo, char hi) noexcept {
+    return _mm_and_si128(
+      _mm_cmpgt_epi8(chars, _mm_set1_epi8(static_cast<char>(lo - 1))),
+      _mm_cmplt_epi8(chars, _mm_set1_epi8(static_cast<char>(hi + 1))));
+  }
+  __m128i equal(__m128i chars, char c) noexcept {
+    return _mm_cmpeq_epi8(chars, _mm_set1_epi8(c));
+  }
+  __m128i either(__m128i lhs, __m128i rhs) noexcept {
+    return _mm_or_si128(lhs, rhs);
+  }
+#endif
+
+#ifdef KN_SCAN_AVX2
+  KN_TARGET_AVX2 __m256i in_range(__m256i chars, char lo, char hi) noexcept {
+    return _mm256_and_si256(
+      _mm256_cmpgt_epi8(chars, _mm256_set1_epi8(static_cast<char>(lo - 1))),
+      _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(hi + 1)), chars));
+  }
+  KN_TARGET_AVX2 __m256i equal(__m256i chars, char c) noexcept {
+    return _mm256_cmpeq_epi8(chars, _mm256_set1_epi8(c));
+  }
+  KN_TARGET_AVX2 __m256i either(__m256i lhs, __m256i rhs) noexcept {
+    return _mm256_or_si256(lhs, rhs);
+  }
+#endif
+
+  struct Blank {
+    static bool test(char c) noexcept {
+      switch (c) {
+      case '\t': case '\n': case '\r':
+      case ' ': case ':':
+      case '(': case ')':
+      case '[': case ']':
+      case '{': case '}':
+        return true;
+      default:
+        return false;
+      }
+    }
+#ifdef KN_SCAN_SSE2
+    static __m128i sse2(__m128i c) noexcept {
+      auto space = either(either(in_range(c, '\t', '\n'), equal(c, '\r')), equal(c, ' '));
+      auto round = either(in_range(c, '(', ')'), equal(c, ':'));
+      auto other = either(either(equal(c, '['), equal(c, ']')), either(equal(c, '{'), equal(c, '}')));
+      return either(space, either(round, other));
+    }
+#endif
+#ifdef KN_SCAN_AVX2
+    KN_TARGET_AVX2 static __m256i avx2(__m256i c) noexcept {
+      auto space = either(either(in_range(c, '\t', '\n'), equal(c, '\r')), equal(c, ' '));
+      auto round = either(in_range(c, '(', ')'), equal(c, ':'));
+      auto other = either(either(equal(c, '['), equal(c, ']')), either(equal(c, '{'), equal(c, '}')));
+      return either(space, either(round, other));
+    }
+#endif
+  };
+
+  struct Digit {
+    static bool test(char c) noexcept { return '0' <= c and c <= '9'; }
+#ifdef KN_SCAN_SSE2
+    static __m128i sse2(__m128i c) noexcept { return in_range(c, '0', '9'); }
+#endif
+#ifdef KN_SCAN_AVX2
+    KN_TARGET_AVX2 static __m256i avx2(__m256i c) noexcept { return in_range(c, '0', '9'); }
+#endif
+  };
+
+  struct Ident {
+    static bool test(char c) noexcept {
+      return ('a' <= c and c <= 'z') or c == '_' or ('0' <= c and c <= '9');
+    }
+#ifdef KN_SCAN_SSE2
+    static __m128i sse2(__m128i c) noexcept {
+      return either(either(in_range(c, 'a', 'z'), equal(c, '_')), in_range(c, '0', '9'));
+    }
+#endif
+#ifdef KN_SCAN_AVX2
+    KN_TARGET_AVX2 static __m256i avx2(__m256i c) noexcept {
+      return either(either(in_range(c, 'a', 'z'), equal(c, '_')), in_range(c, '0', '9'));
+    }
+#endif
+  };
+
+  struct FuncWord {
+    static bool test(char c) noexcept { return ('A' <= c and c <= 'Z') or c == '_'; }
+#ifdef KN_SCAN_SSE2
+    static __m128i sse2(__m128i c) noexcept {
+      return either(in_range(c, 'A', 'Z'), equal(c, '_'));
+    }
+#endif
+#ifdef KN_SCAN_AVX2
+    KN_TARGET_AVX2 static __m256i avx2(__m256i c) noexcept {
+      return either(in_range(c, 'A', 'Z'), equal(c, '_'));
+    }
+#endif
+  };
+
+  template <typename Kind>
+  const char* skip_scalar(const char* first, const char* last) noexcept {
+    while (first != last and Kind::test(*first))
+      ++first;
+    return first;
+  }
+
+#ifdef KN_SCAN_SSE2
+  template <typename Kind>
+  const char* skip_sse2(const char* first, const char* last) noexcept {
+    for (; last - first >= 16; first += 16) {
+      auto chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+      auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(Kind::sse2(chars)));
+      if (auto others = ~mask & 0xffffu)
+        return first + first_set(others);
+    }
+    return skip_scalar<Kind>(first, last);
+  }
+#endif
+
+#ifdef KN_SCAN_AVX2
+  template <typename Kind>
+  KN_TARGET_AVX2 const char* skip_avx2(const char* first, const char* last) noexcept {
+    for (; last - first >= 32; first += 32) {
+      auto chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+      auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(Kind::avx2(chars)));
+      if (auto others = ~mask)
+        return first + first_set(others);
+    }
+    return skip_scalar<Kind>(first, last);
+  }
+#endif
+
+  constexpr Scanners scalar_scanners = {
+    Isa::Scalar,
+    skip_scalar<Blank>, skip_scalar<Digit>, skip_scalar<Ident>, skip_scalar<FuncWord>
+  };
+#ifdef KN_SCAN_SSE2
+  constexpr Scanners sse2_scanners = {
+    Isa::SSE2,
+    skip_sse2<Blank>, skip_sse2<Digit>, skip_sse2<Ident>, skip_sse2<FuncWord>
+  };
+#endif
+#ifdef KN_SCAN_AVX2
+  constexpr Scanners avx2_scanners = {
+    Isa::AVX2,
+    skip_avx2<Blank>, skip_avx2<Digit>, skip_avx2<Ident>, skip_avx2<FuncWord>
+  };
+#endif
+
+  const Scanners* scanners_for(Isa isa) noexcept {
+    switch (isa) {
+    case Isa::Scalar:
+      return &scalar_scanners;
+    case Isa::SSE2:
+#ifdef KN_SCAN_SSE2
+      return &sse2_scanners;
+#else
+      return nullptr;
+#endif
+    case Isa::AVX2:
+#ifdef KN_SCAN_AVX2
+      if (__builtin_cpu_supports("avx2"))
+        return &avx2_scanners;
+#endif
+      return nullptr;
+    }
+    return nullptr;
+  }
+
+  const Scanners* best_scanners() noexcept {
+    for (auto isa : { Isa::AVX2, Isa::SSE2 })
+      if (auto scanners = scanners_for(isa))
+        return scanners;
+    return &scalar_scanners;
+  }
+
+  const Scanners* scanners = best_scanners();
+
+  // most runs are only a character or two long, which isn't
+  // worth setting up the vector code for
+  template <typename Kind>
+  const char* skip(skip_fn vectorised, const char* first, const char* last) noexcept {
+    for (auto i = 0; i < 2; ++i, ++first)
+      if (first == last or not Kind::test(*first))
+        return first;
+    return vectorised(first, last);
+  }
+
+}
+
+namespace kn::lexer {
+
+  Isa best_isa() noexcept {
+    return best_scanners()->isa;
+  }
+
+  Isa current_isa() noexcept {
+    return scanners->isa;
+  }
+
+  std::string_view isa_name(Isa isa) noexcept {
+    switch (isa) {
+    case Isa::Scalar: return "scalar";
+    case Isa::SSE2: return "sse2";
+    case Isa::AVX2: return "avx2";
+    }
+    return "unknown";
+  }
+
+  bool use_isa(Isa isa) noexcept {
+    if (auto chosen = scanners_for(isa)) {
+      scanners = chosen;
+      return true;
+    }
+    return false;
+  }
+
+  const char* skip_blanks(const char* first, const char* last) noexcept {
+    return skip<Blank>(scanners->blanks, first, last);
+  }
+
+  const char* skip_digits(const char* first, const char* last) noexcept {
+    return skip<Digit>(scanners->digits, first, last);
+  }
+
+  const char* skip_ident(const char* first, const char* last) noexcept {
+    return skip<Ident>(scanners->ident, first, last);
+  }
+
+  const char* skip_func_word(const char* first, const char* last) noexcept {
+    return skip<FuncWord>(scanners->func_word, first, last);
+  }
+
+  // the C library's memchr is already vectorised, and picks its own
+  // implementation for the CPU, so there's nothing to gain here
+  const char* find_char(const char* first, const char* last, char c) noexcept {
+    if (first == last)
+      return last;
+    auto found = std::memchr(first, c, static_cast<std::size_t>(last - first));
+    return found ? static_cast<const char*>(found) : last;
+  }
+
+}
@@ -0,0 +1,36 @@
+#ifndef KNIGHT_SCAN_HPP_INCLUDED
+#define KNIGHT_SCAN_HPP_INCLUDED
+
+#include <string_view>
+
+namespace kn::lexer {
+
+  // the instruction sets the scanners can be built on, from worst to best
+  enum class Isa { Scalar, SSE2, AVX2 };
+
+  // the best instruction set this CPU supports, which is used by default
+  Isa best_isa() noexcept;
+  Isa current_isa() noexcept;
+  std::string_view isa_name(Isa isa) noexcept;
+
+  // scan with `isa` from now on, if this CPU supports it;
+  // not thread safe, so only for use before lexing anything
+  bool use_isa(Isa isa) noexcept;
+
+  // each of these gives the first character from `first` on that isn't of
+  // the kind being skipped, or `last` if there is no such character
+
+  // whitespace, and the brackets and colons that Knight ignores
+  const char* skip_blanks(const char* first, const char* last) noexcept;
+  const char* skip_digits(const char* first, const char* last) noexcept;
+  // the rest of an identifier, after its first character
+  const char* skip_ident(const char* first, const char* last) noexcept;
+  // the rest of a word function like `WHILE`, after its first character
+  const char* skip_func_word(const char* first, const char* last) noexcept;
+
+  // the first `c` from `first` on, or `last` if there isn't one
+  const char* find_char(const char* first, const char* last, char c) noexcept;
+
+}
+
+#endif  // KNIGHT_SCAN_HPP_INCLUDED
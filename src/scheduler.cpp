@@ -0,0 +1,134 @@
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <exception>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "error.hpp"
+#include "ir.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+
+namespace {
+
+  long read_some(int fd, char* buffer, std::size_t size) {
+#ifdef _WIN32
+    return ::_read(fd, buffer, static_cast<unsigned>(size));
+#else
+    return static_cast<long>(::read(fd, buffer, size));
+#endif
+  }
+
+}
+
+namespace kn::eval {
+
+  Scheduler::Scheduler(std::size_t slice, std::size_t eval_cache)
+    : slice(slice)
+    , eval_cache(eval_cache)
+    , tasks()
+    , runnable()
+    , parked()
+  {}
+
+  Scheduler::TaskId Scheduler::spawn(
+    std::string_view source, int fd, std::ostream& out, std::string_view data)
+  {
+    auto task = std::make_unique<Task>();
+    task->fd = fd;
+    if (not data.empty())
+      task->input.feed(data);
+    if (fd < 0)
+      task->input.close();
+    task->env.set_io(task->input, out);
+    task->env.evals().set_capacity(eval_cache);
+
+    auto current = CurrentEnvironment(task->env);
+    auto parsed = kn::parser::parse(source);
+    task->code = prepare(kn::ir::optimise(parsed));
+    if (task->code.empty())
+      throw kn::Error("no input");
+    task->offset = enter(task->code);
+
+    auto id = tasks.size();
+    tasks.push_back(std::move(task));
+    runnable.push_back(id);
+    return id;
+  }
+
+  void Scheduler::run(const std::function<void(TaskId, int)>& on_exit) {
+    while (not runnable.empty() or not parked.empty()) {
+      // only sleep when there's nothing else to be getting on with
+      if (not parked.empty())
+        poll_input(runnable.empty());
+      if (runnable.empty())
+        continue;
+
+      auto id = runnable.front();
+      runnable.pop_front();
+      auto& task = *tasks[id];
+
+      auto current = CurrentEnvironment(task.env);
+      try {
+        task.offset = step(task.code, task.offset, slice);
+      } catch (const std::exception& err) {
+        // only this task fails, whatever went wrong
+        task.env.output() << err.what() << '\n';
+        on_exit(id, 1);
+        tasks[id].reset();
+        continue;
+      }
+
+      if (task.offset >= task.code.size()) {
+        on_exit(id, exit_status());
+        tasks[id].reset();
+      } else if (not task.input.ready()) {
+        parked.push_back(id);
+      } else {
+        runnable.push_back(id);
+      }
+    }
+  }
+
+  void Scheduler::poll_input(bool block) {
+    char buffer[64 * 1024];
+    const auto read_into = [&buffer](Task& task) {
+      auto n = read_some(task.fd, buffer, sizeof buffer);
+      if (n > 0)
+        task.input.feed({ buffer, static_cast<std::size_t>(n) });
+      else if (n == 0 or (errno != EAGAIN and errno != EINTR))
+        task.input.close();
+    };
+
+#ifdef _WIN32
+    // no way to wait on several of these at once, so just wait on the first
+    if (block)
+      read_into(*tasks[parked.front()]);
+#else
+    auto fds = std::vector<pollfd>{};
+    for (auto id : parked)
+      fds.push_back({ tasks[id]->fd, POLLIN, 0 });
+    if (::poll(fds.data(), fds.size(), block ? -1 : 0) > 0) {
+      for (std::size_t i = 0; i < fds.size(); ++i) {
+        if (fds[i].revents != 0)
+          read_into(*tasks[parked[i]]);
+      }
+    }
+#endif
+
+    // anything that now has a full line (or hit EOF) can carry on
+    auto woken = std::stable_partition(parked.begin(), parked.end(), [this](TaskId id) {
+      return not tasks[id]->input.ready();
+    });
+    runnable.insert(runnable.end(), woken, parked.end());
+    parked.erase(woken, parked.end());
+  }
+
+}
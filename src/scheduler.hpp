@@ -0,0 +1,60 @@
+#ifndef KNIGHT_SCHEDULER_HPP_INCLUDED
+#define KNIGHT_SCHEDULER_HPP_INCLUDED
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "env.hpp"
+#include "eval.hpp"
+#include "input.hpp"
+
+namespace kn::eval {
+
+  // cooperatively runs many programs on the current thread,
+  // switching between them every `slice` instructions
+  // and parking any that are waiting on PROMPT until their input arrives
+  class Scheduler {
+  public:
+    using TaskId = std::size_t;
+
+    explicit Scheduler(
+      std::size_t slice = 10000, std::size_t eval_cache = EvalCache::default_capacity);
+
+    // compile a new program, which reads its input from `data` and then
+    // the file descriptor `fd` (unless it's negative) and writes to `out`;
+    // throws kn::Error if it fails to compile
+    TaskId spawn(
+      std::string_view source, int fd, std::ostream& out, std::string_view data = {});
+
+    // run until every program has finished, telling `on_exit` as each does
+    void run(const std::function<void(TaskId, int)>& on_exit);
+
+  private:
+    struct Task {
+      Environment env;
+      Input input;
+      ByteCode code;
+      std::size_t offset = 0;
+      int fd = -1;
+    };
+
+    // read whatever input is available for parked tasks,
+    // waking them as their next line arrives
+    void poll_input(bool block);
+
+    std::size_t slice;
+    // the capacity of each program's EVAL cache
+    std::size_t eval_cache;
+    std::vector<std::unique_ptr<Task>> tasks;
+    std::deque<TaskId> runnable;
+    std::vector<TaskId> parked;
+  };
+
+}
+
+#endif  // KNIGHT_SCHEDULER_HPP_INCLUDED
@@ -0,0 +1,25 @@
+#ifndef KNIGHT_SERVER_HPP_INCLUDED
+#define KNIGHT_SERVER_HPP_INCLUDED
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "cache.hpp"
+
+namespace kn::server {
+
+  // serve requests on the unix socket at `path` until killed,
+  // running up to `jobs` scripts at once (zero picks one per hardware thread),
+  // each with room for `eval_cache` code points of EVALed code
+  int serve(
+    const std::string& path, std::size_t jobs,
+    std::size_t eval_cache = kn::eval::EvalCache::default_capacity);
+
+  // run `script` with `input` on the server listening at `path`,
+  // streaming its output to stdout and returning its exit status
+  int submit(const std::string& path, std::string_view script, std::string_view input);
+
+}
+
+#endif  // KNIGHT_SERVER_HPP_INCLUDED
@@ -0,0 +1,332 @@
+// this is pretty dodgy
+#define _POSIX_C_SOURCE 200809L
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "server.hpp"
+#include "env.hpp"
+#include "error.hpp"
+#include "eval.hpp"
+#include "input.hpp"
+#include "ir.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+
+// Protocol: the client sends the script and then its input, each as a
+// native u64 length followed by that many bytes. The server replies with
+// frames of a one byte kind, a u64 length, and a payload: any number of
+// 'o' frames holding output, then one 'x' frame holding the i64 exit status.
+
+namespace {
+
+  constexpr std::uint64_t max_request = std::uint64_t(1) << 30;
+  constexpr std::size_t max_cached = 64;
+
+  void write_all(int fd, const char* data, std::size_t size) {
+    while (size != 0) {
+      auto n = ::write(fd, data, size);
+      if (n < 0 and errno == EINTR)
+        continue;
+      if (n <= 0)
+        throw kn::Error("error: connection closed");
+      data += n;
+      size -= static_cast<std::size_t>(n);
+    }
+  }
+
+  bool read_all(int fd, char* data, std::size_t size) {
+    while (size != 0) {
+      auto n = ::read(fd, data, size);
+      if (n < 0 and errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      data += n;
+      size -= static_cast<std::size_t>(n);
+    }
+    return true;
+  }
+
+  void write_frame(int fd, char kind, const char* data, std::uint64_t size) {
+    char header[1 + sizeof size];
+    header[0] = kind;
+    std::memcpy(header + 1, &size, sizeof size);
+    write_all(fd, header, sizeof header);
+    write_all(fd, data, static_cast<std::size_t>(size));
+  }
+
+  void write_blob(int fd, std::string_view blob) {
+    auto size = std::uint64_t{ blob.size() };
+    write_all(fd, reinterpret_cast<const char*>(&size), sizeof size);
+    write_all(fd, blob.data(), blob.size());
+  }
+
+  bool read_blob(int fd, std::string& blob) {
+    auto size = std::uint64_t{};
+    if (not read_all(fd, reinterpret_cast<char*>(&size), sizeof size)
+        or size > max_request)
+      return false;
+    blob.resize(static_cast<std::size_t>(size));
+    return read_all(fd, blob.data(), blob.size());
+  }
+
+  // sends everything written to it back to the client as output frames
+  class FrameBuf : public std::streambuf {
+  public:
+    explicit FrameBuf(int fd) : fd(fd) {
+      setp(buffer, buffer + sizeof buffer);
+    }
+
+  protected:
+    int_type overflow(int_type c) override {
+      sync();
+      if (not traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+      }
+      return traits_type::not_eof(c);
+    }
+
+    int sync() override {
+      if (auto size = pptr() - pbase(); size != 0) {
+        write_frame(fd, 'o', pbase(), static_cast<std::uint64_t>(size));
+        setp(buffer, buffer + sizeof buffer);
+      }
+      return 0;
+    }
+
+  private:
+    int fd;
+    char buffer[64 * 1024];
+  };
+
+  // a compiled program with its own environment, so that anything EVAL
+  // generates stays around for the next run too
+  struct Program {
+    std::string source;
+    kn::eval::Environment env;
+    kn::eval::ByteCode code;
+    std::size_t last_used = 0;
+  };
+
+  // each worker keeps its own programs, so they never need locking
+  class ProgramCache {
+  public:
+    explicit ProgramCache(std::size_t eval_cache) : eval_cache(eval_cache) {}
+
+    Program& get(const std::string& source) {
+      auto key = std::hash<std::string>{}(source);
+      auto it = programs.find(key);
+      if (it == programs.end() or it->second->source != source) {
+        if (programs.size() >= max_cached)
+          evict();
+        auto program = compile(source, eval_cache);
+        it = programs.insert_or_assign(key, std::move(program)).first;
+      }
+      it->second->last_used = ++clock;
+      return *it->second;
+    }
+
+  private:
+    static std::unique_ptr<Program> compile(
+      const std::string& source, std::size_t eval_cache)
+    {
+      auto program = std::make_unique<Program>();
+      program->source = source;
+      program->env.evals().set_capacity(eval_cache);
+
+      auto current = kn::eval::CurrentEnvironment(program->env);
+      auto parsed = kn::parser::parse(source);
+      program->code = kn::eval::prepare(kn::ir::optimise(parsed));
+
+      if (program->code.empty())
+        throw kn::Error("no input");
+      return program;
+    }
+
+    void evict() {
+      auto oldest = std::min_element(programs.begin(), programs.end(),
+        [](const auto& a, const auto& b) {
+          return a.second->last_used < b.second->last_used;
+        });
+      programs.erase(oldest);
+    }
+
+    std::unordered_map<std::size_t, std::unique_ptr<Program>> programs;
+    std::size_t clock = 0;
+    std::size_t eval_cache;
+  };
+
+  void handle(int fd, ProgramCache& cache) {
+    auto script = std::string{};
+    auto data = std::string{};
+    if (not read_blob(fd, script) or not read_blob(fd, data))
+      return;
+
+    auto buf = FrameBuf(fd);
+    auto out = std::ostream(&buf);
+    // let a dropped client abort the script rather than being ignored
+    out.exceptions(std::ios::badbit);
+
+    auto status = std::int64_t{ 1 };
+    try {
+      auto& program = cache.get(script);
+      auto input = kn::eval::Input(data);
+      auto current = kn::eval::CurrentEnvironment(program.env);
+      program.env.set_io(input, out);
+      program.env.restore_variables({});
+      status = kn::eval::run(program.code);
+      out.flush();
+    } catch (const kn::Error& err) {
+      // if the client went away, there's nobody left to tell
+      if (not out)
+        return;
+      out << err.what() << '\n';
+      out.flush();
+    }
+
+    write_frame(fd, 'x', reinterpret_cast<const char*>(&status), sizeof status);
+  }
+
+  class ConnectionQueue {
+  public:
+    void push(int fd) {
+      {
+        auto lock = std::lock_guard(mutex);
+        fds.push_back(fd);
+      }
+      ready.notify_one();
+    }
+
+    int pop() {
+      auto lock = std::unique_lock(mutex);
+      ready.wait(lock, [this] { return not fds.empty(); });
+      auto fd = fds.front();
+      fds.pop_front();
+      return fd;
+    }
+
+  private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<int> fds;
+  };
+
+  sockaddr_un make_address(const std::string& path) {
+    auto addr = sockaddr_un{};
+    if (path.size() >= sizeof addr.sun_path)
+      throw kn::Error("error: socket path too long: " + path);
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+  }
+
+}
+
+namespace kn::server {
+
+  int serve(const std::string& path, std::size_t jobs, std::size_t eval_cache) {
+    auto addr = make_address(path);
+    auto listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+      throw kn::Error("error: unable to create socket");
+
+    ::unlink(path.c_str());
+    if (::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0
+        or ::listen(listener, SOMAXCONN) != 0)
+      throw kn::Error("error: unable to listen on " + path);
+
+    // clients going away shouldn't take the whole server down with them
+    ::signal(SIGPIPE, SIG_IGN);
+
+    if (jobs == 0)
+      jobs = std::max(1u, std::thread::hardware_concurrency());
+
+    auto queue = ConnectionQueue{};
+    auto workers = std::vector<std::thread>{};
+    for (std::size_t i = 0; i < jobs; ++i) {
+      workers.emplace_back([&queue, eval_cache] {
+        auto cache = ProgramCache(eval_cache);
+        for (;;) {
+          auto fd = queue.pop();
+          try {
+            handle(fd, cache);
+          } catch (const std::exception&) {
+            // the client went away, or its script failed in a way that
+            // only concerns it; either way, carry on with the next one
+          }
+          ::close(fd);
+        }
+      });
+    }
+
+    std::cerr << "listening on " << path << '\n';
+    for (;;) {
+      auto fd = ::accept(listener, nullptr, nullptr);
+      if (fd >= 0)
+        queue.push(fd);
+      else if (errno != EINTR)
+        throw kn::Error("error: accept() failed");
+    }
+  }
+
+  int submit(const std::string& path, std::string_view script, std::string_view input) {
+    auto addr = make_address(path);
+    auto fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 or ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0)
+      throw kn::Error("error: unable to connect to " + path);
+
+    auto output = std::vector<char>{};
+    try {
+      write_blob(fd, script);
+      write_blob(fd, input);
+
+      for (;;) {
+        char kind;
+        auto size = std::uint64_t{};
+        if (not read_all(fd, &kind, 1)
+            or not read_all(fd, reinterpret_cast<char*>(&size), sizeof size)
+            or size > max_request)
+          break;
+        output.resize(static_cast<std::size_t>(size));
+        if (not read_all(fd, output.data(), output.size()))
+          break;
+
+        if (kind == 'o') {
+          std::cout.write(output.data(), static_cast<std::streamsize>(output.size()));
+          std::cout.flush();
+        } else if (kind == 'x' and size == sizeof(std::int64_t)) {
+          auto status = std::int64_t{};
+          std::memcpy(&status, output.data(), sizeof status);
+          ::close(fd);
+          return static_cast<int>(status);
+        }
+      }
+    } catch (...) {
+      ::close(fd);
+      throw;
+    }
+
+    ::close(fd);
+    throw kn::Error("error: lost connection to server");
+  }
+
+}
@@ -0,0 +1,10 @@
+#include "server.hpp"
+#include "error.hpp"
+
+int kn::server::serve(const std::string&, std::size_t, std::size_t) {
+  throw kn::Error("error: --serve is not supported on this platform");
+}
+
+int kn::server::submit(const std::string&, std::string_view, std::string_view) {
+  throw kn::Error("error: --client is not supported on this platform");
+}
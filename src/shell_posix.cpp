@@ -1,24 +1,264 @@
 // this is pretty dodgy
 #define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <memory>
-#include <iostream>
+#include <optional>
+#include <random>
+#include <string_view>
 
 #include "funcs.hpp"
+#include "env.hpp"
 #include "error.hpp"
 
-std::string kn::funcs::open_shell(const std::string& command) {
-  auto close = [](FILE* f) { pclose(f); };
-  auto stream = std::unique_ptr<FILE, decltype(close)>(
-    popen(command.c_str(), "r"), close);
+extern char** environ;
+
+namespace {
+
+  using kn::eval::String;
+
+  // most commands say very little, so start small and grow as needed
+  constexpr std::size_t initial_size = 1024;
+
+  bool persistent_shell = false;
+
+  // read everything from `fd` until EOF or, if given, until what has been
+  // read ends with `sentinel`, which is left off; `found` says which it was
+  String read_output(int fd, std::string_view sentinel = {}, bool* found = nullptr) {
+    auto result = String::uninitialised(initial_size);
+    auto size = std::size_t{ 0 };
+    auto done = false;
+    while (not done) {
+      if (size == result.size()) {
+        auto bigger = String::uninitialised(2 * result.size());
+        std::memcpy(bigger.buffer(), result.buffer(), size);
+        result = std::move(bigger);
+      }
+      auto read = ::read(fd, result.buffer() + size, result.size() - size);
+      if (read < 0 and errno == EINTR)
+        continue;
+      if (read <= 0)
+        break;
+      size += static_cast<std::size_t>(read);
+
+      if (not sentinel.empty() and size >= sentinel.size()) {
+        auto tail = std::string_view(result.buffer() + size - sentinel.size(), sentinel.size());
+        if (tail == sentinel) {
+          size -= sentinel.size();
+          done = true;
+        }
+      }
+    }
+
+    if (found)
+      *found = done;
+    if (size == 0)
+      return String(std::string_view{});
+    // don't keep hold of a buffer that's mostly empty
+    if (size < result.size() / 2)
+      return String(std::string_view(result.buffer(), size));
+    return result.substr(0, size);
+  }
+
+  String run_popen(const std::string& command) {
+    auto close = [](FILE* f) { pclose(f); };
+    auto stream = std::unique_ptr<FILE, decltype(close)>(
+      popen(command.c_str(), "r"), close);
+
+    if (not stream)
+      throw kn::Error("error: unable to execute command: " + command);
+
+    // read straight into the string's own storage, skipping stdio's buffer
+    return read_output(::fileno(stream.get()));
+  }
+
+  // a command can only share the shell if we know its output is over once
+  // it returns, so nothing may be left running in the background
+  bool safe_to_share(std::string_view command) {
+    for (std::size_t i = 0; i < command.size(); ++i) {
+      if (command[i] != '&')
+        continue;
+      if (i + 1 < command.size() and (command[i + 1] == '&' or command[i + 1] == '>')) {
+        ++i;
+        continue;
+      }
+      if (i != 0 and (command[i - 1] == '<' or command[i - 1] == '>'))
+        continue;
+      return false;
+    }
+    return true;
+  }
+
+  // move `fd` out of the way of 0 to 3, and keep it out of children
+  int stash_fd(int fd) {
+    auto moved = ::fcntl(fd, F_DUPFD, 10);
+    ::close(fd);
+    if (moved >= 0)
+      ::fcntl(moved, F_SETFD, FD_CLOEXEC);
+    return moved;
+  }
+
+}
+
+namespace kn::funcs {
+
+  // one `/bin/sh` that runs command after command, each in a subshell so
+  // they can't affect each other; the end of each command's output is
+  // marked by a sentinel, which is random so that nothing will print it
+  class ShellSession {
+  public:
+    ShellSession() {
+      auto random = std::random_device{};
+      auto dist = std::uniform_int_distribution<unsigned long long>{};
+      char token[64];
+      std::snprintf(token, sizeof token, "#kn-done-%016llx%016llx#",
+        dist(random), dist(random));
+      sentinel = token;
+    }
 
-  if (not stream)
-    throw kn::Error("error: unable to execute command: " + command);
+    ~ShellSession() { stop(); }
 
-  std::string result;
-  char buffer[4096]{};
-  while (auto read = ::fread(buffer, 1, sizeof buffer, stream.get()))
-    result.append(buffer, read);
+    ShellSession(const ShellSession&) = delete;
+    ShellSession& operator=(const ShellSession&) = delete;
+
+    // the output of `command`, or nullopt if the shell isn't usable
+    std::optional<String> run(const std::string& command) {
+      if (pid < 0 and not start())
+        return std::nullopt;
+
+      // quote the command for eval, so that however broken it is
+      // the shell still sees the whole line and then the sentinel
+      auto line = std::string("( eval '");
+      for (auto c : command) {
+        if (c == '\'')
+          line += "'\\''";
+        else
+          line += c;
+      }
+      line += "' ) 0<&3 3<&-; printf '%s' '";
+      line += sentinel;
+      line += "'\n";
+
+      if (not write_all(line)) {
+        stop();
+        return std::nullopt;
+      }
+
+      // if the shell went away instead, start another next time
+      auto found = false;
+      auto output = read_output(from_shell, sentinel, &found);
+      if (not found)
+        stop();
+      return output;
+    }
+
+  private:
+    bool start() {
+      int to[2];
+      int from[2];
+      if (::pipe(to) != 0)
+        return false;
+      if (::pipe(from) != 0) {
+        ::close(to[0]);
+        ::close(to[1]);
+        return false;
+      }
+      auto shell_in = stash_fd(to[0]);
+      to_shell = stash_fd(to[1]);
+      from_shell = stash_fd(from[0]);
+      auto shell_out = stash_fd(from[1]);
+
+      // the shell reads commands on stdin, and gives our stdin to them as 3
+      posix_spawn_file_actions_t actions;
+      posix_spawn_file_actions_init(&actions);
+      posix_spawn_file_actions_adddup2(&actions, 0, 3);
+      posix_spawn_file_actions_adddup2(&actions, shell_in, 0);
+      posix_spawn_file_actions_adddup2(&actions, shell_out, 1);
+
+      char sh[] = "sh";
+      char* argv[] = { sh, nullptr };
+      auto spawned = ::posix_spawn(&pid, "/bin/sh", &actions, nullptr, argv, environ);
+      posix_spawn_file_actions_destroy(&actions);
+      ::close(shell_in);
+      ::close(shell_out);
+
+      if (spawned != 0) {
+        pid = -1;
+        ::close(to_shell);
+        ::close(from_shell);
+        return false;
+      }
+      return true;
+    }
+
+    void stop() {
+      if (pid < 0)
+        return;
+      // closing its input is enough for the shell to finish up
+      ::close(to_shell);
+      ::close(from_shell);
+      ::waitpid(pid, nullptr, 0);
+      pid = -1;
+    }
+
+    // if the shell has died, writing to it raises SIGPIPE, which would
+    // kill us; keep it blocked while writing, and discard any it raised
+    bool write_all(std::string_view data) {
+      sigset_t pipe_signal;
+      sigset_t previous;
+      ::sigemptyset(&pipe_signal);
+      ::sigaddset(&pipe_signal, SIGPIPE);
+      ::pthread_sigmask(SIG_BLOCK, &pipe_signal, &previous);
+
+      auto written = true;
+      while (not data.empty()) {
+        auto n = ::write(to_shell, data.data(), data.size());
+        if (n < 0 and errno == EINTR)
+          continue;
+        if (n <= 0) {
+          written = false;
+          break;
+        }
+        data.remove_prefix(static_cast<std::size_t>(n));
+      }
+
+      if (not written and errno == EPIPE) {
+        auto no_wait = timespec{};
+        while (::sigtimedwait(&pipe_signal, nullptr, &no_wait) < 0 and errno == EINTR)
+          ;
+      }
+      ::pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+      return written;
+    }
+
+    pid_t pid = -1;
+    int to_shell = -1;
+    int from_shell = -1;
+    std::string sentinel;
+  };
+
+}
+
+void kn::funcs::set_persistent_shell(bool enabled) noexcept {
+  persistent_shell = enabled;
+}
 
-  return result;
+kn::eval::String kn::funcs::open_shell(const std::string& command) {
+  if (persistent_shell and safe_to_share(command)) {
+    auto& session = kn::eval::Environment::get().shell();
+    if (not session)
+      session = std::make_shared<ShellSession>();
+    if (auto output = session->run(command))
+      return std::move(*output);
+  }
+  return run_popen(command);
 }
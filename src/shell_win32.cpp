@@ -1,4 +1,6 @@
 #include <Windows.h>
+#include <algorithm>
+#include <cstring>
 #include <memory>
 #include <string>
 #include <iterator>
@@ -46,8 +48,12 @@ namespace {
 
 }
 
-std::string kn::funcs::open_shell(const std::string& command) {
+// every command gets its own powershell here, which is the safe choice
+void kn::funcs::set_persistent_shell(bool) noexcept {}
+
+kn::eval::String kn::funcs::open_shell(const std::string& command) {
   using namespace std::literals;
+  using kn::eval::String;
 
   auto attrs = SECURITY_ATTRIBUTES{};
   attrs.nLength = sizeof attrs;
@@ -96,19 +102,42 @@ std::string kn::funcs::open_shell(const std::string& command) {
   CloseHandle(proc_info.hThread);
   stdout_write.reset();
 
-  // read from our end of the pipe until it closes
-  std::string result;
-  char buffer[4096]{};
+  // read from our end of the pipe until it closes,
+  // straight into the string's own storage, which starts small
+  constexpr auto initial_size = std::size_t{ 1024 };
+  auto result = String::uninitialised(initial_size);
+  auto size = std::size_t{ 0 };
   auto read = DWORD{};
-  while (ReadFile(stdout_read.get(), buffer, sizeof buffer, &read, nullptr)
-         and read != 0) {
-    // convert \r\n into \n
-    for (auto it = buffer; it != buffer + read; ++it) {
-      if (*it == '\r' and *std::next(it) == '\n')
+  for (;;) {
+    if (size == result.size()) {
+      auto bigger = String::uninitialised(2 * result.size());
+      std::memcpy(bigger.buffer(), result.buffer(), size);
+      result = std::move(bigger);
+    }
+    auto space = static_cast<DWORD>(std::min<std::size_t>(result.size() - size, MAXDWORD));
+    if (not ReadFile(stdout_read.get(), result.buffer() + size, space, &read, nullptr)
+        or read == 0)
+      break;
+
+    // convert \r\n into \n in place, starting from any '\r' left at
+    // the end of the last read, in case its '\n' has only just arrived
+    auto first = result.buffer() + size;
+    if (size != 0 and first[-1] == '\r')
+      --first;
+    auto last = result.buffer() + size + read;
+    auto out = first;
+    for (auto it = first; it != last; ++it) {
+      if (*it == '\r' and std::next(it) != last and *std::next(it) == '\n')
         ++it;
-      result.push_back(*it);
+      *out++ = *it;
     }
+    size = static_cast<std::size_t>(out - result.buffer());
   }
 
-  return result;
+  if (size == 0)
+    return String(std::string_view{});
+  // don't keep hold of a buffer that's mostly empty
+  if (size < result.size() / 2)
+    return String(std::string_view(result.buffer(), size));
+  return result.substr(0, size);
 }
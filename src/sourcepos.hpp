@@ -1,10 +1,11 @@
 #ifndef KNIGHT_SOURCEPOS_HPP_INCLUDED
 #define KNIGHT_SOURCEPOS_HPP_INCLUDED
 
+#include <algorithm>
 #include <cstddef>
-#include <iterator>
-#include <locale>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace kn {
 
@@ -24,70 +25,28 @@ namespace kn {
     }
   };
 
-  // combine a SourcePosition on a character stream
-  class SourceIterator {
+  // where each line of a source starts, to turn byte offsets back into
+  // positions; this takes a pass over the whole source, so is only built
+  // once something actually wants to report a position
+  class LineIndex {
   public:
-    using value_type = char;
-    using reference = const char&;
-    using difference_type = std::ptrdiff_t;
-    using pointer = void;
-    using iterator_category = std::forward_iterator_tag;
-
-    constexpr SourceIterator(const char* c, SourcePosition pos = { 1, 1 })
-      : c(c), m_pos(pos)
-    {}
-
-    [[nodiscard]] constexpr const char* base() const noexcept { return c; }
-    [[nodiscard]] constexpr SourcePosition pos() const noexcept { return m_pos; }
-
-    friend constexpr
-    bool operator==(const SourceIterator& lhs, const SourceIterator& rhs) noexcept {
-      return lhs.c == rhs.c;
-    }
-    friend constexpr
-    bool operator==(const SourceIterator& lhs, const char* rhs) noexcept {
-      return lhs.c == rhs;
-    }
-    friend constexpr
-    bool operator==(const char* lhs, const SourceIterator& rhs) noexcept {
-      return lhs == rhs.c;
-    }
-
-    friend constexpr
-    bool operator!=(const SourceIterator& lhs, const SourceIterator& rhs) noexcept {
-      return !(lhs == rhs);
-    }
-    friend constexpr
-    bool operator!=(const SourceIterator& lhs, const char* rhs) noexcept {
-      return !(lhs == rhs);
-    }
-    friend constexpr
-    bool operator!=(const char* lhs, const SourceIterator& rhs) noexcept {
-      return !(lhs == rhs);
-    }
-
-    constexpr reference operator*() const noexcept { return *c; }
-
-    constexpr SourceIterator& operator++() noexcept {
-      if (*c == '\n') {
-        ++m_pos.line;
-        m_pos.column = 1;
-      } else {
-        ++m_pos.column;
-      }
-      ++c;
-      return *this;
+    explicit LineIndex(std::string_view source) {
+      m_starts.push_back(0);
+      for (std::size_t i = 0; i < source.size(); ++i)
+        if (source[i] == '\n')
+          m_starts.push_back(i + 1);
     }
 
-    constexpr SourceIterator operator++(int) noexcept {
-      SourceIterator old{ *this };
-      ++*this;
-      return old;
+    [[nodiscard]] SourcePosition at(std::size_t offset) const noexcept {
+      auto line = std::upper_bound(m_starts.begin(), m_starts.end(), offset) - 1;
+      return {
+        static_cast<int>(line - m_starts.begin()) + 1,
+        static_cast<int>(offset - *line) + 1
+      };
     }
 
   private:
-    const char* c;
-    SourcePosition m_pos;
+    std::vector<std::size_t> m_starts;
   };
 
 }
@@ -3,6 +3,7 @@
 #include "env.hpp"
 
 #include <memory>
+#include <optional>
 #include <charconv>
 
 namespace {
@@ -23,9 +24,10 @@ namespace {
     return result;
   }
 
-  kn::eval::String true_str(std::string_view("true"));
-  kn::eval::String false_str(std::string_view("false"));
-  kn::eval::String null_str(std::string_view("null"));
+  // reference counts aren't atomic, so each thread needs its own copy
+  thread_local kn::eval::String true_str(std::string_view("true"));
+  thread_local kn::eval::String false_str(std::string_view("false"));
+  thread_local kn::eval::String null_str(std::string_view("null"));
 
   constexpr auto value_offset = sizeof(std::size_t);
   char* alloc_string(std::size_t size) {
@@ -46,11 +48,22 @@ namespace kn::eval {
     std::uninitialized_copy(value.begin(), value.end(), p + value_offset);
   }
 
+  String String::uninitialised(std::size_t size) {
+    return String(alloc_string(size), 0, size);
+  }
+
+  String String::borrow(std::string_view value) noexcept {
+    auto address = reinterpret_cast<std::uintptr_t>(value.data());
+    auto base = address & ~(borrowed_align - 1);
+    return String(
+      reinterpret_cast<void*>(base | borrowed_tag), address - base, value.size());
+  }
+
   String String::substr(std::size_t pos, std::size_t len) const {
     assert(pos < m_size);
     assert(pos + len <= m_size);
 
-    ++num_refs();
+    retain();
     return String(m_data, m_pos + pos, len);
   }
 
@@ -77,9 +90,10 @@ namespace kn::eval {
     auto view = as_str_view();
     if (not view.empty() and view.back() == '\\') {
       view.remove_suffix(1);
-      os << view << std::flush;
+      os.write(view.data(), static_cast<std::streamsize>(view.size()));
     } else {
-      os << view << '\n' << std::flush;
+      os.write(view.data(), static_cast<std::streamsize>(view.size()));
+      os.put('\n');
     }
   }
 
@@ -109,6 +123,35 @@ namespace kn::eval {
 
 
 
+  struct Pending {
+    explicit Pending(std::future<String> result)
+      : refs(1), result(std::move(result)), value()
+    {}
+
+    const String& get() {
+      if (not value)
+        value = result.get();
+      return *value;
+    }
+
+    std::size_t refs;
+    std::future<String> result;
+    std::optional<String> value;
+  };
+
+  Value Value::from_future(std::future<String> result) {
+    auto v = Value{};
+    v.type = Type::Pending;
+    v.pending = new Pending(std::move(result));
+    return v;
+  }
+
+  Value& Value::resolve() {
+    if (type == Type::Pending)
+      *this = pending->get();
+    return *this;
+  }
+
   Value::Value(const Value& other)
     : type(other.type)
   {
@@ -117,7 +160,8 @@ namespace kn::eval {
     case Type::Number: number = other.number; break;
     case Type::Block: block = other.block; break;
     case Type::Null: break;
-    case Type::String: new (&string) String(other.string);
+    case Type::String: new (&string) String(other.string); break;
+    case Type::Pending: pending = other.pending; ++pending->refs; break;
     }
   }
 
@@ -129,22 +173,25 @@ namespace kn::eval {
     case Type::Number: number = other.number; break;
     case Type::Block: block = other.block; break;
     case Type::Null: break;
-    case Type::String: new (&string) String(std::move(other.string));
+    case Type::String: new (&string) String(std::move(other.string)); break;
+    case Type::Pending: pending = std::exchange(other.pending, nullptr); break;
     }
   }
 
   Value& Value::operator=(const Value& other) {
     if (this == &other)
       return *this;
-    if (type == Type::String)
-      string.~String();
+    if (other.type == Type::Pending)
+      ++other.pending->refs;
+    release();
     type = other.type;
     switch (type) {
     case Type::Boolean: boolean = other.boolean; break;
     case Type::Number: number = other.number; break;
     case Type::Block: block = other.block; break;
     case Type::Null: break;
-    case Type::String: new (&string) String(other.string);
+    case Type::String: new (&string) String(other.string); break;
+    case Type::Pending: pending = other.pending; break;
     }
     return *this;
   }
@@ -152,28 +199,35 @@ namespace kn::eval {
   Value& Value::operator=(Value&& other) noexcept {
     if (this == &other)
       return *this;
-    if (type == Type::String)
-      string.~String();
+    release();
     type = other.type;  // don't exchange
     switch (type) {
     case Type::Boolean: boolean = other.boolean; break;
     case Type::Number: number = other.number; break;
     case Type::Block: block = other.block; break;
     case Type::Null: break;
-    case Type::String: new (&string) String(std::move(other.string));
+    case Type::String: new (&string) String(std::move(other.string)); break;
+    case Type::Pending: pending = std::exchange(other.pending, nullptr); break;
     }
     return *this;
   }
 
   Value::~Value() {
+    release();
+  }
+
+  void Value::release() noexcept {
     if (type == Type::String)
       string.~String();
+    else if (type == Type::Pending and pending and --pending->refs == 0)
+      delete pending;
   }
 
   Boolean Value::to_bool() const {
     if (type == Type::Boolean) return boolean;
     if (type == Type::Number) return number != 0;
     if (type == Type::String) return string.size() != 0;
+    if (type == Type::Pending) return pending->get().size() != 0;
     return false;  // null
   }
 
@@ -181,6 +235,7 @@ namespace kn::eval {
     if (type == Type::Boolean) return boolean ? 1 : 0;
     if (type == Type::Number) return number;
     if (type == Type::String) return string_to_number(string);
+    if (type == Type::Pending) return string_to_number(pending->get());
     return 0;  // null
   }
 
@@ -188,6 +243,7 @@ namespace kn::eval {
     if (type == Type::Boolean) return boolean ? true_str : false_str;
     if (type == Type::Number) return String(std::to_string(number));
     if (type == Type::String) return string;
+    if (type == Type::Pending) return pending->get();
     return null_str;  // null
   }
 
@@ -196,6 +252,7 @@ namespace kn::eval {
     if (type == Type::Boolean) return boolean ? true_str : false_str;
     if (type == Type::Number) return String(std::to_string(number));
     if (type == Type::String) return std::move(string);
+    if (type == Type::Pending) return pending->get();
     return null_str;  // null
   }
 
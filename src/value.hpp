@@ -1,6 +1,8 @@
 #ifndef KNIGHT_VALUE_HPP_INCLUDED
 #define KNIGHT_VALUE_HPP_INCLUDED
 
+#include <cstdint>
+#include <future>
 #include <new>
 #include <ostream>
 #include <utility>
@@ -38,13 +40,22 @@ namespace kn::eval {
     explicit String(const std::string& value) : String(std::string_view(value)) {};
     explicit String(std::string_view value);
 
+    // a string of `size` unspecified characters, to be filled in
+    // through `buffer` before anything else gets to see them
+    static String uninitialised(std::size_t size);
+    // a string referring to `value` without owning it, for things like
+    // literals in a mapped source file; the characters must stay put
+    // for as long as anything could read this or a copy of it
+    static String borrow(std::string_view value) noexcept;
+    char* buffer() noexcept { return const_cast<char*>(value()); }
+
     ~String() { release(); }
 
     String(const String& other)
       : m_data(other.m_data)
       , m_pos(other.m_pos)
       , m_size(other.m_size)
-    { ++num_refs(); }
+    { retain(); }
 
     String(String&& other) noexcept
       : m_data(std::exchange(other.m_data, nullptr))
@@ -58,7 +69,7 @@ namespace kn::eval {
         m_data = other.m_data;
         m_pos = other.m_pos;
         m_size = other.m_size;
-        ++num_refs();
+        retain();
       }
       return *this;
     }
@@ -109,11 +120,29 @@ namespace kn::eval {
     std::size_t m_pos;
     std::size_t m_size;
 
+    // borrowed strings have no count, and are marked by tagging `m_data`,
+    // which then points (rounded down) to the characters themselves
+    static constexpr std::uintptr_t borrowed_tag = 1;
+    static constexpr std::uintptr_t borrowed_align = alignof(std::size_t);
+
+    bool is_borrowed() const noexcept {
+      return (reinterpret_cast<std::uintptr_t>(m_data) & borrowed_tag) != 0;
+    }
+
     std::size_t& num_refs() const noexcept {
       return *std::launder(reinterpret_cast<std::size_t*>(m_data));
     }
 
+    void retain() const noexcept {
+      if (not is_borrowed())
+        ++num_refs();
+    }
+
     const char* raw_value() const noexcept {
+      if (is_borrowed()) {
+        auto base = reinterpret_cast<std::uintptr_t>(m_data) & ~borrowed_tag;
+        return reinterpret_cast<const char*>(base);
+      }
       return std::launder(static_cast<const char*>(m_data) + sizeof(std::size_t));
     }
 
@@ -122,7 +151,7 @@ namespace kn::eval {
     }
 
     void release() noexcept {
-      if (not m_data)
+      if (not m_data or is_borrowed())
         return;
       if (--num_refs() == 0)
         ::operator delete(m_data);
@@ -134,9 +163,13 @@ namespace kn::eval {
     std::size_t address;
   };
 
+  // the string result of something still running, like an asynchronous
+  // SHELL, which is only waited for once something needs to look at it
+  struct Pending;
+
   class Value {
     enum class Type {
-      Null, Boolean, Number, String, Block
+      Null, Boolean, Number, String, Block, Pending
     };
 
   public:
@@ -148,6 +181,7 @@ namespace kn::eval {
     Value(Number x) : Value(x.value) {}
     Value(String s) : type(Type::String), string(std::move(s)) {}
     Value(Block b) : type(Type::Block), block(b.address) {}
+    static Value from_future(std::future<String> result);
 
     Value(const Value& other);
     Value(Value&& other) noexcept;
@@ -161,6 +195,15 @@ namespace kn::eval {
     bool is_bool() const noexcept { return type == Type::Boolean; }
     bool is_number() const noexcept { return type == Type::Number; }
     bool is_string() const noexcept { return type == Type::String; }
+    bool is_block() const noexcept { return type == Type::Block; }
+    bool is_pending() const noexcept { return type == Type::Pending; }
+
+    const String* as_string() const noexcept {
+      return type == Type::String ? &string : nullptr;
+    }
+
+    // wait for a pending result, and become it
+    Value& resolve();
 
     Boolean to_bool() const;
     Number to_number() const;
@@ -182,6 +225,8 @@ namespace kn::eval {
         return lhs.block == rhs.block;
       case Type::String:
         return lhs.string == rhs.string;
+      case Type::Pending:
+        return lhs.pending == rhs.pending;
       }
       return false;
     }
@@ -198,6 +243,8 @@ namespace kn::eval {
         return os << "String(" << value.string << ")";
       case Type::Block:
         return os << "Function(" << value.block << ")";
+      case Type::Pending:
+        return os << "Pending()";
       }
       return os;
     }
@@ -210,7 +257,10 @@ namespace kn::eval {
       Number::type number;
       String string;
       std::size_t block;
+      Pending* pending;
     };
+
+    void release() noexcept;
   };
 
 }